@@ -0,0 +1,76 @@
+# Turns data/known_models.csv into known_models_data.h, the knownModels array
+# that src/known_models.h builds its lookup table from. The file is checked
+# here, so a bad row fails at configure time with its line number.
+#
+#   generate_known_models(<target>)
+#
+# writes the header to <build dir>/generated and adds that to the target's
+# include directories. CMake configures again when the CSV changes.
+
+set(KNOWN_MODELS_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
+function(generate_known_models target)
+	set(csv "${KNOWN_MODELS_DIR}/../data/known_models.csv")
+	set(out_dir "${CMAKE_BINARY_DIR}/generated")
+	set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${csv}")
+
+	file(STRINGS "${csv}" lines)
+	set(KNOWN_MODEL_COUNT 0)
+	set(KNOWN_MODEL_ENTRIES "")
+	set(previous "")
+	set(line_number 0)
+	set(header_seen FALSE)
+	foreach(line IN LISTS lines)
+		math(EXPR line_number "${line_number} + 1")
+		string(STRIP "${line}" line)
+		if(line STREQUAL "" OR line MATCHES "^#")
+			continue()
+		endif()
+		if(NOT header_seen)
+			if(NOT line STREQUAL "id,mccs_version,brightness,contrast,power_mode")
+				message(FATAL_ERROR "${csv}:${line_number}: unexpected header")
+			endif()
+			set(header_seen TRUE)
+			continue()
+		endif()
+
+		string(REPLACE "," ";" fields "${line}")
+		list(LENGTH fields field_count)
+		if(NOT field_count EQUAL 5)
+			message(FATAL_ERROR "${csv}:${line_number}: expected 5 fields")
+		endif()
+		list(GET fields 0 id)
+		list(GET fields 1 version)
+		if(NOT id MATCHES "^[A-Z][A-Z][A-Z][0-9A-F][0-9A-F][0-9A-F][0-9A-F]$")
+			message(FATAL_ERROR "${csv}:${line_number}: '${id}' is not an EDID id like ABC1234")
+		endif()
+		if(NOT version MATCHES "^[0-9]+\\.[0-9]+$")
+			message(FATAL_ERROR "${csv}:${line_number}: '${version}' is not an MCCS version")
+		endif()
+		if(NOT previous STREQUAL "" AND NOT previous STRLESS id)
+			message(FATAL_ERROR "${csv}:${line_number}: ${id} is out of order or a duplicate")
+		endif()
+		set(previous "${id}")
+
+		set(flags "")
+		foreach(index 2 3 4)
+			list(GET fields ${index} flag)
+			if(flag STREQUAL "1")
+				string(APPEND flags ", true")
+			elseif(flag STREQUAL "0")
+				string(APPEND flags ", false")
+			else()
+				message(FATAL_ERROR "${csv}:${line_number}: '${flag}' should be 0 or 1")
+			endif()
+		endforeach()
+
+		string(APPEND KNOWN_MODEL_ENTRIES "    {\"${id}\", \"${version}\"${flags}},\n")
+		math(EXPR KNOWN_MODEL_COUNT "${KNOWN_MODEL_COUNT} + 1")
+	endforeach()
+	if(NOT header_seen)
+		message(FATAL_ERROR "${csv}: no header row")
+	endif()
+
+	configure_file("${KNOWN_MODELS_DIR}/known_models_data.h.in" "${out_dir}/known_models_data.h" @ONLY)
+	target_include_directories(${target} PRIVATE "${out_dir}")
+endfunction()
@@ -0,0 +1,85 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, the backend files do not depend on JUCE and are
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The low level operations MonitorControl needs from a monitor: enumerate,
+// ask for the capabilities string, and read or write a VCP code.
+// Implementations must allow getVcp() and setVcp() to be called concurrently
+// for different monitors.
+class MonitorBackend
+{
+public:
+    using Handle = uintptr_t;
+
+    struct PhysicalMonitor
+    {
+        Handle handle;
+        std::wstring description;
+        // Monitors with the same bus number share a connection and can't be
+        // addressed in parallel.
+        uint32_t bus = 0;
+        // EDID manufacturer and product code, like "ABC1234", if known
+        std::string model = {};
+    };
+
+    virtual ~MonitorBackend() {}
+
+    // shown to the user, to tell monitors from different sources apart
+    virtual const char * name() const = 0;
+
+    // True if writes are practically free, unlike DDC/CI commands which take
+    // tens of milliseconds on a slow I2C bus.
+    virtual bool isFast() const { return false; }
+
+    virtual std::vector<PhysicalMonitor> enumerate() = 0;
+
+    virtual bool capabilities(Handle monitor, std::string & caps) = 0;
+    virtual bool getVcp(Handle monitor, uint8_t code, uint32_t & current, uint32_t & max) = 0;
+    virtual bool setVcp(Handle monitor, uint8_t code, uint32_t value) = 0;
+};
+
+
+// DDC/CI through the Windows low-level monitor configuration API. Elsewhere
+// this finds no monitors, see backend_none.cpp.
+std::unique_ptr<MonitorBackend> createDdcBackend();
+
+// Calls `callback` with true or false when the OS switches all displays on or
+// off. The callback runs on the thread that created the watcher, which must
+// run a message loop. nullptr where the OS doesn't tell.
+class DisplayPowerWatcher
+{
+public:
+    virtual ~DisplayPowerWatcher() {}
+};
+
+std::unique_ptr<DisplayPowerWatcher> watchDisplayPower(std::function<void(bool)> callback);
+
+// Laptop panels under a sysfs backlight class directory, normally
+// /sys/class/backlight.
+std::unique_ptr<MonitorBackend> createBacklightBackend(const std::wstring & rootPath);
+
+// Pass-through backends which log every call made to the `inner` ones, with
+// arguments, results and timings, to one binary trace file.
+std::vector<std::unique_ptr<MonitorBackend>> createRecordingBackends(
+    std::vector<std::unique_ptr<MonitorBackend>> inner,
+    const std::wstring & tracePath);
+
+// Serves the responses from a recorded trace, one backend for every recorded
+// one. Latencies are the recorded ones multiplied by `timeScale`, so 1
+// reproduces the original timing and 0 answers immediately.
+std::vector<std::unique_ptr<MonitorBackend>> createReplayBackends(
+    const std::wstring & tracePath,
+    float timeScale);
@@ -0,0 +1,98 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, the backend files do not depend on JUCE and are
+available under GPLv3 and the MIT license.
+*/
+
+#include "backend.h"
+#include "vcp.h"
+
+#include <filesystem>
+#include <fstream>
+
+
+namespace fs = std::filesystem;
+
+
+// Internal panels exposed by the kernel as /sys/class/backlight/<name>/, with
+// a `brightness` and a `max_brightness` file. These speak the same VCP
+// vocabulary as DDC monitors, but only support brightness.
+class BacklightBackend : public MonitorBackend
+{
+    fs::path root;
+    std::vector<fs::path> panels;
+
+    static bool readValue(const fs::path & file, uint32_t & value)
+    {
+        std::ifstream in(file);
+        long long v = -1;
+        in >> v;
+        if (!in || v < 0) return false;
+        value = (uint32_t) v;
+        return true;
+    }
+
+    const fs::path * panel(Handle h) const
+    {
+        return (h >= 1 && h <= panels.size()) ? &panels[h - 1] : nullptr;
+    }
+
+public:
+    explicit BacklightBackend(const std::wstring & rootPath)
+        : root(rootPath)
+    {}
+
+    virtual const char * name() const override { return "Backlight"; }
+
+    virtual bool isFast() const override { return true; }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override
+    {
+        panels.clear();
+        std::vector<PhysicalMonitor> result;
+
+        std::error_code ec;
+        for (const auto & entry : fs::directory_iterator(root, ec))
+        {
+            uint32_t max = 0;
+            if (!readValue(entry.path() / "max_brightness", max) || max == 0) continue;
+
+            panels.push_back(entry.path());
+            result.push_back({(Handle) panels.size(), entry.path().filename().wstring(), (uint32_t) panels.size()});
+        }
+        return result;
+    }
+
+    virtual bool capabilities(Handle monitor, std::string & caps) override
+    {
+        if (!panel(monitor)) return false;
+        caps = "(prot(backlight)type(LCD)vcp(10))";
+        return true;
+    }
+
+    virtual bool getVcp(Handle monitor, uint8_t code, uint32_t & current, uint32_t & max) override
+    {
+        const auto * p = panel(monitor);
+        if (!p || code != Vcp::brightness) return false;
+        return readValue(*p / "max_brightness", max) && readValue(*p / "brightness", current);
+    }
+
+    virtual bool setVcp(Handle monitor, uint8_t code, uint32_t value) override
+    {
+        const auto * p = panel(monitor);
+        if (!p || code != Vcp::brightness) return false;
+        std::ofstream out(*p / "brightness");
+        out << value;
+        out.flush();
+        return (bool) out;
+    }
+};
+
+
+std::unique_ptr<MonitorBackend> createBacklightBackend(const std::wstring & rootPath)
+{
+    return std::make_unique<BacklightBackend>(rootPath);
+}
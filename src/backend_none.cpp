@@ -0,0 +1,38 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, the backend files do not depend on JUCE and are
+available under GPLv3 and the MIT license.
+*/
+
+#include "backend.h"
+
+
+// Platforms without DDC/CI support: no external monitors, and no notice when
+// the displays switch off. Laptop panels still work through the backlight
+// backend.
+class NoDdcBackend : public MonitorBackend
+{
+public:
+    virtual const char * name() const override { return "DDC/CI"; }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override { return {}; }
+
+    virtual bool capabilities(Handle, std::string &) override { return false; }
+    virtual bool getVcp(Handle, uint8_t, uint32_t &, uint32_t &) override { return false; }
+    virtual bool setVcp(Handle, uint8_t, uint32_t) override { return false; }
+};
+
+
+std::unique_ptr<MonitorBackend> createDdcBackend()
+{
+    return std::make_unique<NoDdcBackend>();
+}
+
+
+std::unique_ptr<DisplayPowerWatcher> watchDisplayPower(std::function<void(bool)>)
+{
+    return nullptr;
+}
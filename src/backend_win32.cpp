@@ -0,0 +1,222 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, the backend files do not depend on JUCE and are
+available under GPLv3 and the MIT license.
+*/
+
+#include "backend.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cwchar>
+#include <Windows.h>
+#include <lowlevelmonitorconfigurationapi.h>
+
+
+class DdcBackend : public MonitorBackend
+{
+    // physical monitors per logical monitor
+    std::vector<std::vector<PHYSICAL_MONITOR>> physicalMonitorLists;
+    // and their EDID model IDs
+    std::vector<std::vector<std::string>> modelLists;
+
+    static HANDLE toHandle(Handle h) { return reinterpret_cast<HANDLE>(h); }
+
+    // The monitor devices on the display output of a logical monitor have IDs
+    // like "MONITOR\ABC1234\{...}\0001". We assume they come in the same
+    // order as the physical monitors, which is all the API gives to go on.
+    static std::vector<std::string> modelIds(HMONITOR logicalMonitor)
+    {
+        std::vector<std::string> result;
+        MONITORINFOEXW info = {};
+        info.cbSize = sizeof(info);
+        if (!GetMonitorInfoW(logicalMonitor, &info)) return result;
+
+        DISPLAY_DEVICEW device = {};
+        device.cb = sizeof(device);
+        for (DWORD i = 0; EnumDisplayDevicesW(info.szDevice, i, &device, 0); ++i)
+        {
+            const wchar_t * begin = std::wcschr(device.DeviceID, L'\\');
+            const wchar_t * end = begin ? std::wcschr(begin + 1, L'\\') : nullptr;
+
+            // EDID ids are plain ASCII
+            std::string id;
+            if (end)
+            {
+                for (const wchar_t * c = begin + 1; c != end; ++c) { id += (char) *c; }
+            }
+            result.push_back(id);
+        }
+        return result;
+    }
+
+public:
+
+    virtual const char * name() const override { return "DDC/CI"; }
+
+    ~DdcBackend()
+    {
+        for (auto & data : physicalMonitorLists)
+        {
+            DestroyPhysicalMonitors((DWORD) data.size(), data.data());
+        }
+    }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override
+    {
+        auto monitorProc = [](
+            HMONITOR logicalMonitor,
+            HDC,
+            LPRECT,
+            LPARAM selfPtr) -> BOOL
+        {
+            auto * self = reinterpret_cast<DdcBackend*>(selfPtr);
+
+            // We got a logical monitor here. Get physical monitor handles.
+            DWORD amount = 0;
+            bool ok = true;
+            ok = ok && GetNumberOfPhysicalMonitorsFromHMONITOR(logicalMonitor, &amount);
+            assert(ok);
+            if (!ok || amount == 0) return true;
+
+            std::vector<PHYSICAL_MONITOR> logicalMonitorData(amount);
+            ok = ok && GetPhysicalMonitorsFromHMONITOR(logicalMonitor, amount, logicalMonitorData.data());
+            assert(ok);
+            if (ok)
+            {
+                self->physicalMonitorLists.push_back(std::move(logicalMonitorData));
+                self->modelLists.push_back(modelIds(logicalMonitor));
+            }
+
+            return true;
+        };
+
+        for (auto & data : physicalMonitorLists)
+        {
+            DestroyPhysicalMonitors((DWORD) data.size(), data.data());
+        }
+        physicalMonitorLists.clear();
+        modelLists.clear();
+
+        EnumDisplayMonitors(NULL, NULL, monitorProc, reinterpret_cast<LPARAM>(this));
+
+        // Physical monitors behind one logical monitor share a display output,
+        // so they are treated as one bus.
+        std::vector<PhysicalMonitor> result;
+        for (size_t bus = 0; bus < physicalMonitorLists.size(); ++bus)
+        {
+            const auto & physicals = physicalMonitorLists[bus];
+            const auto & models = modelLists[bus];
+            for (size_t i = 0; i < physicals.size(); ++i)
+            {
+                result.push_back({
+                    reinterpret_cast<Handle>(physicals[i].hPhysicalMonitor),
+                    physicals[i].szPhysicalMonitorDescription,
+                    (uint32_t) bus,
+                    i < models.size() ? models[i] : std::string()});
+            }
+        }
+        return result;
+    }
+
+    virtual bool capabilities(Handle monitor, std::string & caps) override
+    {
+        // asking for the length first would cost another round trip
+        char capStr[4096];
+        if (!CapabilitiesRequestAndCapabilitiesReply(toHandle(monitor), capStr, 4096))
+        {
+            caps.clear();
+            return false;
+        }
+        capStr[4095] = '\0';
+        caps = capStr;
+        return true;
+    }
+
+    virtual bool getVcp(Handle monitor, uint8_t code, uint32_t & current, uint32_t & max) override
+    {
+        MC_VCP_CODE_TYPE type;
+        DWORD c = 0, m = 0;
+        bool ok = GetVCPFeatureAndVCPFeatureReply(toHandle(monitor), code, &type, &c, &m);
+        current = c;
+        max = m;
+        return ok;
+    }
+
+    virtual bool setVcp(Handle monitor, uint8_t code, uint32_t value) override
+    {
+        return SetVCPFeature(toHandle(monitor), code, (DWORD) value);
+    }
+};
+
+
+std::unique_ptr<MonitorBackend> createDdcBackend()
+{
+    return std::make_unique<DdcBackend>();
+}
+
+
+// GUID_CONSOLE_DISPLAY_STATE, spelled out so we don't depend on initguid.h
+static const GUID consoleDisplayState =
+    {0x6fe69556, 0x704a, 0x47a0, {0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47}};
+
+
+class Win32DisplayPowerWatcher : public DisplayPowerWatcher
+{
+    static constexpr const wchar_t * className = L"MonitorBrightnessPowerWatcher";
+
+    std::function<void(bool)> callback;
+    HWND window = NULL;
+    HPOWERNOTIFY notify = NULL;
+
+    static LRESULT CALLBACK windowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+    {
+        auto * self = reinterpret_cast<Win32DisplayPowerWatcher*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA));
+        if (self && msg == WM_POWERBROADCAST && wParam == PBT_POWERSETTINGCHANGE)
+        {
+            const auto * setting = reinterpret_cast<const POWERBROADCAST_SETTING*>(lParam);
+            if (std::memcmp(&setting->PowerSetting, &consoleDisplayState, sizeof(GUID)) == 0)
+            {
+                // 0 = off, 1 = on, 2 = dimmed
+                self->callback(setting->Data[0] != 0);
+            }
+            return TRUE;
+        }
+        return DefWindowProcW(hwnd, msg, wParam, lParam);
+    }
+
+public:
+    explicit Win32DisplayPowerWatcher(std::function<void(bool)> cb)
+        : callback(std::move(cb))
+    {
+        WNDCLASSEXW wc = {};
+        wc.cbSize = sizeof(wc);
+        wc.lpfnWndProc = windowProc;
+        wc.hInstance = GetModuleHandleW(NULL);
+        wc.lpszClassName = className;
+        RegisterClassExW(&wc);
+
+        // a message-only window is enough to receive power broadcasts
+        window = CreateWindowExW(0, className, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, wc.hInstance, NULL);
+        if (!window) return;
+        SetWindowLongPtrW(window, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+        notify = RegisterPowerSettingNotification(window, &consoleDisplayState, DEVICE_NOTIFY_WINDOW_HANDLE);
+    }
+
+    ~Win32DisplayPowerWatcher()
+    {
+        if (notify) { UnregisterPowerSettingNotification(notify); }
+        if (window) { DestroyWindow(window); }
+        UnregisterClassW(className, GetModuleHandleW(NULL));
+    }
+};
+
+
+std::unique_ptr<DisplayPowerWatcher> watchDisplayPower(std::function<void(bool)> callback)
+{
+    return std::make_unique<Win32DisplayPowerWatcher>(std::move(callback));
+}
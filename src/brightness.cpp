@@ -32,47 +32,495 @@ SOFTWARE.
 */
 
 #include "brightness.h"
+#include "backend.h"
+#include "events.h"
+#include "known_models.h"
+#include "scheduler.h"
+#include "state_segment.h"
+#include "vcp.h"
 
 #include <array>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
-#include <map>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <unordered_map>
 #include <stdio.h>
 #include <algorithm>
-#include <Windows.h>
-#include <lowlevelmonitorconfigurationapi.h>
 
 // note that GetMonitorCapabilities() only works for specific (and older) MCCS versions.
 
-static constexpr uint8_t VCP_BRIGHTNESS = 0x10;
-static constexpr uint8_t VCP_CONTRAST = 0x12;
-
 
 static const std::regex vcpRe("vcp\\(");
 static const std::regex mccsVerRe("mccs_ver\\(");
 static const std::regex hexRe("[0-9A-Z]+");
 
 
+// Monitor names are UTF-16 on Windows. Writes a zero terminated, possibly
+// truncated UTF-8 version of `text` to `dest`.
+static void copyUtf8(const std::wstring & text, char * dest, size_t size)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        uint32_t c = (uint32_t) text[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < text.size())
+        {
+            c = 0x10000 + ((c - 0xd800) << 10) + ((uint32_t) text[++i] - 0xdc00);
+        }
+
+        char buf[4];
+        size_t len;
+        if (c < 0x80) { buf[0] = (char) c; len = 1; }
+        else if (c < 0x800) { buf[0] = (char) (0xc0 | (c >> 6)); len = 2; }
+        else if (c < 0x10000) { buf[0] = (char) (0xe0 | (c >> 12)); len = 3; }
+        else { buf[0] = (char) (0xf0 | (c >> 18)); len = 4; }
+        for (size_t k = 1; k < len; ++k)
+        {
+            buf[k] = (char) (0x80 | ((c >> (6 * (len - 1 - k))) & 0x3f));
+        }
+
+        if (n + len >= size) break;
+        std::memcpy(dest + n, buf, len);
+        n += len;
+    }
+    dest[n] = '\0';
+}
+
+
+// The parts of a capabilities string we use.
+struct Capabilities
+{
+    std::string version;
+    bool doesBrightness = false;
+    bool doesContrast = false;
+    bool doesPowerMode = false;
+};
+
+
+// Get and parse supported VCP codes.
+// This gets some coded stuff like this (somewhat truncated for
+// brevity, and wrapped). We are interested in the "vcp()" part.
+// 
+// (prot(monitor)type(LCD)model(Blah)cmds(01 02 03 07 0C E3 F3)
+// vcp(02 04 05 08 0C 10 12 14(01 05 06 08 0B))
+// mswhql(1)asset_eep(40)mccs_ver(2.2))
+//
+// Returns false if there is no vcp() list.
+static bool parseCapabilities(const std::string & caps, Capabilities & result)
+{
+    const char * capStr = caps.c_str();
+
+    std::cmatch m;
+
+    // find "mccs_ver("
+    const char * capIt = capStr;
+    if (std::regex_search(capIt, m, mccsVerRe))
+    {
+        capIt = m[0].second;
+        const char *ver = capIt;
+        while (*capIt && *capIt != ')') { ++capIt; }
+        result.version = std::string(ver, capIt);
+    }
+
+    // find "vcp("
+    capIt = capStr;
+    if (!std::regex_search(capIt, m, vcpRe)) return false;
+
+    // parsing loop
+    capIt = m[0].second;
+    int depth = 1;
+    while (depth > 0)
+    {
+        if (*capIt == ' ') { ++capIt; }
+        else if (*capIt == '(') { ++depth; ++capIt; }
+        else if (*capIt == ')') { --depth; ++capIt; }
+        else if (std::regex_search(capIt, m, hexRe))
+        {
+            if (depth == 1)
+            {
+                long capCode = std::stol(capIt, nullptr, 16);
+                if (capCode == Vcp::brightness) { result.doesBrightness = true; }
+                if (capCode == Vcp::contrast) { result.doesContrast = true; }
+                if (capCode == Vcp::powerMode) { result.doesPowerMode = true; }
+            }
+            capIt = m[0].second;
+        }
+        else
+        {
+            assert(false);
+            break;
+        }
+    }
+    return true;
+}
+
+
 MonitorControl::MonitorControl() {}
 MonitorControl::~MonitorControl() {}
 
 
 class MonitorControlImpl : public MonitorControl
 {
-    struct physicalList
+    // monitors are identified by their backend and its handle
+    using MonitorKey = std::pair<MonitorBackend *, MonitorBackend::Handle>;
+
+    struct MonitorKeyHash
     {
-        PHYSICAL_MONITOR list[32];
-        DWORD amount;
+        size_t operator()(const MonitorKey & k) const
+        {
+            return std::hash<const void *>()(k.first) ^ (std::hash<MonitorBackend::Handle>()(k.second) * 31);
+        }
     };
 
-    std::vector<physicalList> physicalMonitorLists;
-    std::map<HANDLE, MonitorInfo> monitors;
+    using Clock = std::chrono::steady_clock;
+
+    // how often a sleeping monitor is asked if it woke up
+    static constexpr std::chrono::seconds powerCheckInterval{10};
+
+    // bits for Monitor::pending
+    static uint8_t pendingBit(uint8_t code)
+    {
+        return code == Vcp::brightness ? 1 : code == Vcp::contrast ? 2 : 0;
+    }
+
+    struct Monitor
+    {
+        MonitorKey key;
+        uint32_t bus;
+        MonitorInfo info;
+
+        bool doesPowerMode = false;
+        Clock::time_point nextPowerCheck;
+        // a power mode read is on its way, see requestPowerCheck()
+        bool powerCheckQueued = false;
+        // values in `info` that still have to be sent, see queueWrite()
+        uint8_t pending = 0;
+        // per pending bit, goes up with every write to recognise outdated
+        // background reads
+        uint64_t writeSerial[2] = {};
+        // probed from the known model table, see verifyKnownModels()
+        bool knownModel = false;
+
+        // health as last told to subscribers
+        bool reportedResponding = true;
+        bool reportedPoweredOn = true;
+
+        // without the maximum a slider position can't be turned into a value
+        bool acceptsWrites() const { return info.poweredOn && !powerCheckQueued && hasValues(); }
+        bool hasValues() const
+        {
+            return (!info.doesBrightness || info.maxBrightness > 0) && (!info.doesContrast || info.maxContrast > 0);
+        }
+    };
+
+    std::vector<std::unique_ptr<MonitorBackend>> backends;
+
+    // in probing order, with an index for lookups by identity
+    std::vector<Monitor> monitors;
+    std::unordered_map<MonitorKey, size_t, MonitorKeyHash> monitorIndex;
 
     Settings settings;
 
     float brightness = 0, contrast = 0;
-    
+
+    // finished background reads and capability checks, handed over by the
+    // scheduler's workers
+    struct CompletedRead
+    {
+        BusScheduler::Command command;
+        uint64_t writeSerial;
+    };
+    std::mutex completionMutex;
+    std::vector<CompletedRead> completedReads;
+    std::function<void()> wakeupCallback;
+
+    // The list only changes on our thread, which doesn't need the lock to
+    // read it. pollEvent() may come from elsewhere.
+    std::mutex subscriberMutex;
+    std::vector<std::pair<SubscriberId, std::shared_ptr<EventSubscriber>>> subscribers;
+    SubscriberId nextSubscriberId = 1;
+    // callback events are waiting for handleCompletions()
+    bool deliveryRequested = false;
+
+    // after everything its workers might touch
+    BusScheduler scheduler;
+    UpdateStats updateStats;
+
+    std::unique_ptr<SharedStatePublisher> sharedState;
+    std::unique_ptr<DisplayPowerWatcher> powerWatcher;
+
+    Monitor * findMonitor(const MonitorKey & key)
+    {
+        auto it = monitorIndex.find(key);
+        return it != monitorIndex.end() ? &monitors[it->second] : nullptr;
+    }
+
+    std::shared_ptr<EventSubscriber> findSubscriber(SubscriberId id)
+    {
+        std::lock_guard<std::mutex> lock(subscriberMutex);
+        for (const auto & s : subscribers)
+        {
+            if (s.first == id) return s.second;
+        }
+        return nullptr;
+    }
+
+    Event makeEvent(Event::Type type, const Monitor & m) const
+    {
+        Event e;
+        e.type = type;
+        e.monitor = (uint32_t) (&m - monitors.data());
+        e.responding = m.info.responding;
+        e.poweredOn = m.info.poweredOn;
+        return e;
+    }
+
+    void post(const Event & e)
+    {
+        bool wakeup = false;
+        for (const auto & s : subscribers)
+        {
+            if (s.second->post(e) && s.second->options.callback) { wakeup = true; }
+        }
+
+        if (wakeup) { requestDelivery(); }
+    }
+
+    // one wakeup until the callbacks ran
+    void requestDelivery()
+    {
+        if (deliveryRequested) return;
+        deliveryRequested = true;
+
+        std::function<void()> callback;
+        {
+            std::lock_guard<std::mutex> lock(completionMutex);
+            callback = wakeupCallback;
+        }
+        if (callback) { callback(); }
+    }
+
+    void postValue(Event::Type type, const Monitor & m, uint8_t code, int value)
+    {
+        if (subscribers.empty()) return;
+        Event e = makeEvent(type, m);
+        e.code = code;
+        e.value = value;
+        post(e);
+    }
+
+    void reportHealth()
+    {
+        for (auto & m : monitors)
+        {
+            if (m.info.responding == m.reportedResponding && m.info.poweredOn == m.reportedPoweredOn) continue;
+            m.reportedResponding = m.info.responding;
+            m.reportedPoweredOn = m.info.poweredOn;
+            if (!subscribers.empty()) { post(makeEvent(Event::healthChanged, m)); }
+        }
+    }
+
+    // Monitors in standby don't get any commands, those would only run into
+    // the DDC timeout and hold up the rest. Neither do monitors whose power
+    // mode is being checked. Only the latest value is kept, and sent when the
+    // monitor wakes up.
+    template <uint8_t Code>
+    void queueWrite(std::vector<BusScheduler::Command> & writes, Monitor & m, uint32_t value)
+    {
+        if (m.acceptsWrites())
+        {
+            writes.push_back(BusScheduler::write<Code>(m.key.first, m.key.second, m.bus, value));
+            m.pending &= ~pendingBit(Code);
+            ++m.writeSerial[pendingBit(Code) >> 1];
+        }
+        else
+        {
+            m.pending |= pendingBit(Code);
+        }
+    }
+
+    // add the held back values of all monitors that are on
+    void flushPending(std::vector<BusScheduler::Command> & writes)
+    {
+        for (auto & m : monitors)
+        {
+            if (!m.pending || !m.acceptsWrites()) continue;
+
+            if (m.pending & pendingBit(Vcp::brightness))
+            {
+                queueWrite<Vcp::brightness>(writes, m, (uint32_t) m.info.currentBrightness);
+            }
+            if (m.pending & pendingBit(Vcp::contrast))
+            {
+                queueWrite<Vcp::contrast>(writes, m, (uint32_t) m.info.currentContrast);
+            }
+        }
+    }
+
+    static void applyPowerMode(Monitor & m, const BusScheduler::Command & r)
+    {
+        m.info.poweredOn = r.ok && BusScheduler::valueOf<Vcp::powerMode>(r) == PowerMode::on;
+        m.nextPowerCheck = Clock::now() + powerCheckInterval;
+    }
+
+    // Ask monitors whether they are on, if they know VCP 0xD6, and wait for
+    // the answer. Only while probing, later use requestPowerCheck().
+    void checkPowerMode(const std::vector<Monitor *> & toCheck)
+    {
+        std::vector<BusScheduler::Command> reads;
+        for (auto * m : toCheck)
+        {
+            if (m->doesPowerMode)
+            {
+                reads.push_back(BusScheduler::read<Vcp::powerMode>(m->key.first, m->key.second, m->bus));
+            }
+        }
+        scheduler.run(reads, false, Priority::scheduled);
+
+        for (const auto & r : reads)
+        {
+            if (auto * m = findMonitor({r.backend, r.monitor})) { applyPowerMode(*m, r); }
+        }
+        reportHealth();
+    }
+
+    // The same without waiting: the answers come in through
+    // handleCompletions(), which sends what was held back in the meantime.
+    void requestPowerCheck(const std::vector<Monitor *> & toCheck)
+    {
+        std::vector<BusScheduler::Command> reads;
+        for (auto * m : toCheck)
+        {
+            if (!m->doesPowerMode || m->powerCheckQueued) continue;
+            m->powerCheckQueued = true;
+            reads.push_back(BusScheduler::read<Vcp::powerMode>(m->key.first, m->key.second, m->bus));
+        }
+        if (reads.empty()) return;
+
+        scheduler.submit(std::move(reads), Priority::scheduled,
+            [this](std::vector<BusScheduler::Command> & done)
+            {
+                std::function<void()> wakeup;
+                {
+                    // failed reads too, those mean the monitor is off
+                    std::lock_guard<std::mutex> lock(completionMutex);
+                    for (auto & c : done) { completedReads.push_back({c, 0}); }
+                    wakeup = wakeupCallback;
+                }
+                if (wakeup) { wakeup(); }
+            });
+    }
+
+    // occasionally check whether sleeping monitors woke up by themselves,
+    // the answer also reads values that failed before
+    void checkSleepingMonitors()
+    {
+        const auto now = Clock::now();
+        std::vector<Monitor *> toCheck;
+        for (auto & m : monitors)
+        {
+            if ((!m.info.poweredOn || !m.hasValues()) && m.doesPowerMode && now >= m.nextPowerCheck)
+            {
+                toCheck.push_back(&m);
+            }
+        }
+        requestPowerCheck(toCheck);
+    }
+
+    // Monitors that were asleep while probing still need their values read.
+    // After that they follow the sliders like the others.
+    void readMissingValues(const std::vector<Monitor *> & wokeUp)
+    {
+        std::vector<Monitor *> toRead;
+        for (auto * m : wokeUp)
+        {
+            if (!m->hasValues() && m->info.responding) { toRead.push_back(m); }
+        }
+        if (toRead.empty()) return;
+
+        readValues(toRead);
+        for (auto * m : toRead)
+        {
+            const int b = (int) std::round(brightness * m->info.maxBrightness);
+            if (m->info.doesBrightness && b != m->info.currentBrightness)
+            {
+                m->info.currentBrightness = b;
+                m->pending |= pendingBit(Vcp::brightness);
+            }
+            const int c = std::min((int) std::round(contrast * m->info.neutralContrast), m->info.maxContrast);
+            if (m->info.doesContrast && c != m->info.currentContrast)
+            {
+                m->info.currentContrast = c;
+                m->pending |= pendingBit(Vcp::contrast);
+            }
+        }
+    }
+
+    void applyWrites(std::vector<BusScheduler::Command> & writes, Priority priority = Priority::interactive)
+    {
+        flushPending(writes);
+        if (writes.empty()) return;
+        updateStats = scheduler.run(writes, settings.synchronizedUpdates, priority);
+
+        std::vector<Monitor *> failed;
+        for (const auto & w : writes)
+        {
+            if (auto * m = findMonitor({w.backend, w.monitor}))
+            {
+                m->info.responding = w.ok;
+                if (w.ok)
+                {
+                    postValue(Event::valueApplied, *m, w.code, (int) w.value);
+                }
+                else
+                {
+                    // keep the value, and find out if it went to sleep
+                    m->pending |= pendingBit(w.code);
+                    failed.push_back(m);
+                }
+            }
+        }
+        requestPowerCheck(failed);
+        reportHealth();
+        publishState();
+    }
+
+    void publishState()
+    {
+        if (!sharedState) return;
+
+        sharedState->publish([this](SharedStateSegment & segment)
+        {
+            const size_t count = std::min(monitors.size(), (size_t) maxSharedMonitors);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const auto & info = monitors[i].info;
+                auto & shared = segment.monitors[i];
+                copyUtf8(info.name, shared.name, sizeof(shared.name));
+                std::strncpy(shared.source, info.source.c_str(), sizeof(shared.source) - 1);
+                shared.source[sizeof(shared.source) - 1] = '\0';
+                shared.currentBrightness = info.currentBrightness;
+                shared.maxBrightness = info.maxBrightness;
+                shared.currentContrast = info.currentContrast;
+                shared.maxContrast = info.maxContrast;
+                shared.flags =
+                    (info.doesBrightness ? (uint32_t) SharedMonitorState::doesBrightness : 0u) |
+                    (info.doesContrast ? (uint32_t) SharedMonitorState::doesContrast : 0u) |
+                    (info.responding ? (uint32_t) SharedMonitorState::responding : 0u) |
+                    (info.poweredOn ? 0u : (uint32_t) SharedMonitorState::poweredOff);
+            }
+            segment.monitorCount = (uint32_t) count;
+            // readers can tell that the rest didn't fit
+            segment.totalMonitorCount = (uint32_t) monitors.size();
+        });
+    }
+
 public:
 
     MonitorControlImpl(Settings savedSettings)
@@ -80,11 +528,27 @@ public:
         settings(std::move(savedSettings))
     {}
 
+    void addBackend(std::unique_ptr<MonitorBackend> backend)
+    {
+        backends.push_back(std::move(backend));
+    }
+
+    void watchPower()
+    {
+        powerWatcher = watchDisplayPower([this](bool on) { displayPowerChanged(on); });
+    }
+
+    void publishStateTo(const std::wstring & segmentName)
+    {
+        sharedState = std::make_unique<SharedStatePublisher>(segmentName);
+        if (!sharedState->isValid()) { sharedState.reset(); }
+    }
+
     virtual bool hasAnySupportedMonitors() const override
     {
         for (const auto& m : monitors)
         {
-            if (m.second.doesBrightness) return true;
+            if (m.info.doesBrightness) return true;
         }
         return false;
     }
@@ -98,18 +562,21 @@ public:
     virtual void setBrightness(float v) override
     {
         brightness = v;
+        checkSleepingMonitors();
+        std::vector<BusScheduler::Command> writes;
         for (auto & m : monitors)
         {
-            if (m.second.doesBrightness)
+            if (m.info.doesBrightness)
             {
-                int b = (int) std::round(v * m.second.maxBrightness);
-                if (b != m.second.currentBrightness)
+                int b = (int) std::round(v * m.info.maxBrightness);
+                if (b != m.info.currentBrightness)
                 {
-                    m.second.currentBrightness = b;
-                    SetVCPFeature(m.first, VCP_BRIGHTNESS, (DWORD) b);
+                    m.info.currentBrightness = b;
+                    queueWrite<Vcp::brightness>(writes, m, (uint32_t) b);
                 }
             }
         }
+        applyWrites(writes);
     }
 
 
@@ -120,10 +587,10 @@ public:
         // handle new neutral contrast values
         for (auto & m : monitors)
         {
-            auto it = settings.savedNeutralContrast.find(m.second.name);
+            auto it = settings.savedNeutralContrast.find(m.info.name);
             if (it != settings.savedNeutralContrast.end())
             {
-                m.second.neutralContrast = it->second;
+                m.info.neutralContrast = it->second;
             }
         }
 
@@ -142,7 +609,7 @@ public:
         float maxC = 0;
         for (auto & m : monitors)
         {
-            maxC = std::max(maxC, (float) m.second.maxContrast / m.second.neutralContrast);
+            maxC = std::max(maxC, (float) m.info.maxContrast / m.info.neutralContrast);
         }
         maxC = std::min(2.f, maxC);
         return maxC;
@@ -152,19 +619,22 @@ public:
     virtual void setContrast(float v) override
     {
         contrast = v;
+        checkSleepingMonitors();
+        std::vector<BusScheduler::Command> writes;
         for (auto & m : monitors)
         {
-            if (m.second.doesContrast)
+            if (m.info.doesContrast)
             {
-                int c = (int) std::round(v * m.second.neutralContrast);
-                c = std::min(c, m.second.maxContrast);
-                if (c != m.second.currentContrast)
+                int c = (int) std::round(v * m.info.neutralContrast);
+                c = std::min(c, m.info.maxContrast);
+                if (c != m.info.currentContrast)
                 {
-                    m.second.currentContrast = c;
-                    SetVCPFeature(m.first, VCP_CONTRAST, (DWORD) c);
+                    m.info.currentContrast = c;
+                    queueWrite<Vcp::contrast>(writes, m, (uint32_t) c);
                 }
             }
         }
+        applyWrites(writes);
     }
 
 
@@ -172,157 +642,449 @@ public:
     {
         std::vector<MonitorInfo> info;
         info.reserve(monitors.size());
-        for (const auto & p : monitors)
+        for (const auto & m : monitors)
         {
-            info.push_back(p.second);
+            info.push_back(m.info);
         }
         return info;
     }
 
 
-    void probe()
+    virtual UpdateStats lastUpdateStats() const override
     {
-        auto monitorProc = [](
-            HMONITOR logicalMonitor,
-            HDC,
-            LPRECT,
-            LPARAM selfPtr) -> BOOL
-        {
-            auto * self = reinterpret_cast<MonitorControlImpl*>(selfPtr);
-
-            // We got a logical monitor here. Get physical monitor handles.
-            self->physicalMonitorLists.push_back({});
-            auto & logicalMonitorData = self->physicalMonitorLists.back();
+        return updateStats;
+    }
 
-            DWORD amount;
-            bool ok = true;
-            ok = ok && GetNumberOfPhysicalMonitorsFromHMONITOR(logicalMonitor, &amount);
-            assert(ok);
-            amount = std::min<DWORD>(amount, 32);
-            logicalMonitorData.amount = amount;
 
-            ok = ok && GetPhysicalMonitorsFromHMONITOR(logicalMonitor, amount, logicalMonitorData.list);
-            assert(ok);
+    virtual QueueStats queueStats() const override
+    {
+        return scheduler.queueStats();
+    }
 
-            for (DWORD i = 0; i < amount; ++i)
-            {
-                const auto physicalMonitor = logicalMonitorData.list[i].hPhysicalMonitor;
 
-                auto monitorPairIB = self->monitors.insert({physicalMonitor, MonitorInfo{}});
+    virtual ActivityStats activityStats() const override
+    {
+        return scheduler.activityStats();
+    }
 
-                if (!monitorPairIB.second)
-                {
-                    continue;
-                }
 
-                MonitorInfo & info = monitorPairIB.first->second;
-                info.name = logicalMonitorData.list[i].szPhysicalMonitorDescription;
+    virtual void releaseIdleResources() override
+    {
+        scheduler.releaseIdleLanes();
 
-                // Get and parse supported VCP codes.
-                // This gets some coded stuff like this (somewhat truncated for
-                // brevity, and wrapped). We are interested in the "vcp()" part.
-                // 
-                // (prot(monitor)type(LCD)model(Blah)cmds(01 02 03 07 0C E3 F3)
-                // vcp(02 04 05 08 0C 10 12 14(01 05 06 08 0B))
-                // mswhql(1)asset_eep(40)mccs_ver(2.2))
+        std::lock_guard<std::mutex> lock(completionMutex);
+        if (completedReads.empty()) { std::vector<CompletedRead>().swap(completedReads); }
+    }
 
-                char capStr[4096];
-                ok = ok && CapabilitiesRequestAndCapabilitiesReply(physicalMonitor, capStr, 4096);
 
-                std::cmatch m;
+    virtual void refresh() override
+    {
+        scheduler.cancel(Priority::background);
 
-                // find "mccs_ver("
-                const char * capIt = capStr;
-                if (std::regex_search(capIt, m, mccsVerRe))
-                {
-                    capIt = m[0].second;
-                    const char *ver = capIt;
-                    while (*capIt && *capIt != ')') { ++capIt; }
-                    info.version = std::string(ver, capIt);
-                }
+        std::vector<BusScheduler::Command> reads;
+        std::vector<uint64_t> serials;
+        for (const auto & m : monitors)
+        {
+            if (!m.info.poweredOn) continue;
+            if (m.info.doesBrightness)
+            {
+                reads.push_back(BusScheduler::read<Vcp::brightness>(m.key.first, m.key.second, m.bus));
+                serials.push_back(m.writeSerial[pendingBit(Vcp::brightness) >> 1]);
+            }
+            if (m.info.doesContrast)
+            {
+                reads.push_back(BusScheduler::read<Vcp::contrast>(m.key.first, m.key.second, m.bus));
+                serials.push_back(m.writeSerial[pendingBit(Vcp::contrast) >> 1]);
+            }
+        }
+        if (reads.empty()) return;
 
-                // find "vcp("
-                capIt = capStr;
-                if (std::regex_search(capIt, m, vcpRe))
+        scheduler.submit(std::move(reads), Priority::background,
+            [this, serials](std::vector<BusScheduler::Command> & done)
+            {
+                std::function<void()> wakeup;
                 {
-                    // parsing loop
-                    capIt = m[0].second;
-                    int depth = 1;
-                    while (depth > 0)
+                    std::lock_guard<std::mutex> lock(completionMutex);
+                    for (size_t i = 0; i < done.size(); ++i)
                     {
-                        if (*capIt == ' ') { ++capIt; }
-                        else if (*capIt == '(') { ++depth; ++capIt; }
-                        else if (*capIt == ')') { --depth; ++capIt; }
-                        else if (std::regex_search(capIt, m, hexRe))
-                        {
-                            if (depth == 1)
-                            {
-                                long capCode = std::stol(capIt, nullptr, 16);
-                                if (capCode == VCP_BRIGHTNESS) { info.doesBrightness = true; }
-                                if (capCode == VCP_CONTRAST) { info.doesContrast = true; }
-                            }
-                            capIt = m[0].second;
-                        }
-                        else
-                        {
-                            assert(false);
-                            break;
-                        }
+                        if (done[i].ok && !done[i].cancelled) { completedReads.push_back({done[i], serials[i]}); }
                     }
+                    // a cancelled refresh doesn't need anyone to wake up
+                    if (!completedReads.empty()) { wakeup = wakeupCallback; }
+                }
+                if (wakeup) { wakeup(); }
+            });
+    }
 
-                    // read current and max values
-                    MC_VCP_CODE_TYPE type;
-                    DWORD current = 0, max = 0;
-                    if (info.doesBrightness)
-                    {
-                        ok = ok && GetVCPFeatureAndVCPFeatureReply(physicalMonitor, VCP_BRIGHTNESS, &type, &current, &max);
-                        assert(ok);
-                        info.currentBrightness = current;
-                        info.maxBrightness = max;
-                        if (self->brightness == 0) {
-                            self->brightness = (float) current / max;
-                        }
-                    }
-                    if (info.doesContrast)
-                    {
-                        ok = ok && GetVCPFeatureAndVCPFeatureReply(physicalMonitor, VCP_CONTRAST, &type, &current, &max);
-                        assert(ok);
-                        info.currentContrast = current;
-                        info.maxContrast = max;
-
-                        // "neutral" contrast level depends on settings
-                        auto & defaultNeutral = self->settings.savedNeutralContrast;
-                        auto pairIB = defaultNeutral.insert({info.name, max});
-                        info.neutralContrast = pairIB.first->second;
-
-                        if (self->contrast == 0) {
-                            self->contrast = (float) current / info.neutralContrast;
-                        }
-                    }
+
+    virtual void setWakeupCallback(std::function<void()> callback) override
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        wakeupCallback = std::move(callback);
+    }
+
+
+    virtual void handleCompletions() override
+    {
+        std::vector<CompletedRead> reads;
+        {
+            std::lock_guard<std::mutex> lock(completionMutex);
+            reads.swap(completedReads);
+        }
+
+        bool changed = false;
+        std::vector<Monitor *> wokeUp;
+        for (const auto & r : reads)
+        {
+            auto * m = findMonitor({r.command.backend, r.command.monitor});
+            if (m && r.command.kind == BusScheduler::Command::capabilities)
+            {
+                changed = checkKnownModel(*m, r.command.caps) || changed;
+                continue;
+            }
+            if (m && r.command.code == Vcp::powerMode)
+            {
+                m->powerCheckQueued = false;
+                if (r.command.cancelled) continue;
+                applyPowerMode(*m, r.command);
+                if (m->info.poweredOn) { wokeUp.push_back(m); }
+                changed = true;
+                continue;
+            }
+            // skip values we wrote over since
+            if (!m || m->writeSerial[pendingBit(r.command.code) >> 1] != r.writeSerial) continue;
+
+            int & current = r.command.code == Vcp::brightness ? m->info.currentBrightness : m->info.currentContrast;
+            if (current != (int) r.command.value)
+            {
+                current = (int) r.command.value;
+                changed = true;
+                postValue(Event::driftDetected, *m, r.command.code, current);
+            }
+        }
+        if (!wokeUp.empty())
+        {
+            // send what was held back, this publishes the state too
+            readMissingValues(wokeUp);
+            std::vector<BusScheduler::Command> writes;
+            applyWrites(writes, Priority::scheduled);
+        }
+        reportHealth();
+        if (changed) { publishState(); }
+
+        deliverEvents();
+    }
+
+
+    void deliverEvents()
+    {
+        deliveryRequested = false;
+        // a callback may unsubscribe
+        const auto current = subscribers;
+        for (const auto & s : current)
+        {
+            if (!s.second->options.callback) continue;
+            Event e;
+            while (s.second->poll(e)) { s.second->options.callback(e); }
+        }
+    }
+
+
+    virtual void displayPowerChanged(bool on) override
+    {
+        std::vector<Monitor *> wokeUp;
+        for (auto & m : monitors)
+        {
+            if (!on) { m.info.poweredOn = false; }
+            else if (!m.doesPowerMode)
+            {
+                m.info.poweredOn = true;
+                wokeUp.push_back(&m);
+            }
+            else { m.nextPowerCheck = Clock::now(); }
+        }
+        // the ones that can tell are flushed when they answer
+        if (on)
+        {
+            checkSleepingMonitors();
+            readMissingValues(wokeUp);
+        }
+
+        // on wake-up, send only the final state of anything that changed
+        std::vector<BusScheduler::Command> writes;
+        applyWrites(writes, Priority::scheduled);
+        reportHealth();
+        publishState();
+    }
+
+
+    virtual SubscriberId subscribe(SubscriberOptions options) override
+    {
+        auto subscriber = std::make_shared<EventSubscriber>(std::move(options));
+        const SubscriberId id = nextSubscriberId++;
+        {
+            std::lock_guard<std::mutex> lock(subscriberMutex);
+            subscribers.push_back({id, subscriber});
+        }
+
+        // start with what is there, as if it was just found
+        for (const auto & m : monitors)
+        {
+            subscriber->post(makeEvent(Event::monitorAdded, m));
+        }
+        if (subscriber->options.callback && !monitors.empty()) { requestDelivery(); }
+        return id;
+    }
+
+
+    virtual void unsubscribe(SubscriberId id) override
+    {
+        std::lock_guard<std::mutex> lock(subscriberMutex);
+        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+            [id](const auto & s) { return s.first == id; }), subscribers.end());
+    }
+
+
+    virtual bool pollEvent(SubscriberId id, Event & event) override
+    {
+        auto subscriber = findSubscriber(id);
+        return subscriber && !subscriber->options.callback && subscriber->poll(event);
+    }
+
+
+    virtual intptr_t readinessHandle(SubscriberId id) override
+    {
+        auto subscriber = findSubscriber(id);
+        return subscriber ? subscriber->readinessHandle() : -1;
+    }
+
+
+    // Finds all monitors first, then probes them in steps that each go to
+    // all monitors at once, so different buses are probed in parallel.
+    void probe()
+    {
+        std::vector<BusScheduler::Command> requests;
+        for (auto & backend : backends)
+        {
+            for (const auto & physicalMonitor : backend->enumerate())
+            {
+                addMonitor(backend.get(), physicalMonitor, requests);
+            }
+        }
+
+        // only the monitors that aren't in the known model table
+        scheduler.run(requests, false, Priority::scheduled);
+        for (const auto & r : requests)
+        {
+            if (auto * m = findMonitor({r.backend, r.monitor}))
+            {
+                Capabilities caps;
+                m->info.responding = r.ok;
+                if (parseCapabilities(r.caps, caps)) { applyCapabilities(*m, caps); }
+                else { m->info.version = caps.version; }
+            }
+        }
+
+        std::vector<Monitor *> usable, toRead;
+        for (auto & m : monitors)
+        {
+            if (!m.info.doesBrightness && !m.info.doesContrast && !m.doesPowerMode) continue;
+            usable.push_back(&m);
+        }
+
+        // remember whether they are on, so they won't get commands in standby
+        checkPowerMode(usable);
+
+        // the others are read when they wake up, see readMissingValues()
+        for (auto * m : usable)
+        {
+            if (m->info.responding && m->info.poweredOn) { toRead.push_back(m); }
+        }
+        readValues(toRead);
+
+        publishState();
+        if (settings.verifyKnownModels) { verifyKnownModels(); }
+    }
+
+    // Adds the monitor, and the capabilities request to `requests` unless it
+    // is a known model.
+    void addMonitor(MonitorBackend * backend, const MonitorBackend::PhysicalMonitor & physicalMonitor,
+        std::vector<BusScheduler::Command> & requests)
+    {
+        const MonitorKey key{backend, physicalMonitor.handle};
+        if (!monitorIndex.insert({key, monitors.size()}).second)
+        {
+            return;
+        }
+        monitors.emplace_back();
+        Monitor & monitor = monitors.back();
+        monitor.key = key;
+        monitor.bus = physicalMonitor.bus;
+
+        MonitorInfo & info = monitor.info;
+        info.name = physicalMonitor.description;
+        info.source = backend->name();
+
+        // known models don't need the slow capabilities request
+        if (const KnownModel * known = findKnownModel(physicalMonitor.model))
+        {
+            applyCapabilities(monitor, {known->mccsVersion, known->doesBrightness, known->doesContrast, known->doesPowerMode});
+            monitor.knownModel = true;
+        }
+        else
+        {
+            requests.push_back(BusScheduler::capabilitiesOf(backend, physicalMonitor.handle, physicalMonitor.bus));
+        }
+    }
+
+    static void applyCapabilities(Monitor & monitor, const Capabilities & caps)
+    {
+        monitor.info.version = caps.version;
+        monitor.info.doesBrightness = caps.doesBrightness;
+        monitor.info.doesContrast = caps.doesContrast;
+        monitor.doesPowerMode = caps.doesPowerMode;
+    }
+
+    // Read current and max values. Goes through the scheduler, as this can
+    // also happen while background work is on the bus.
+    void readValues(const std::vector<Monitor *> & toRead)
+    {
+        std::vector<BusScheduler::Command> reads;
+        for (auto * m : toRead)
+        {
+            if (m->info.doesBrightness) { reads.push_back(BusScheduler::read<Vcp::brightness>(m->key.first, m->key.second, m->bus)); }
+            if (m->info.doesContrast) { reads.push_back(BusScheduler::read<Vcp::contrast>(m->key.first, m->key.second, m->bus)); }
+        }
+        scheduler.run(reads, false, Priority::scheduled);
+
+        for (const auto & r : reads)
+        {
+            auto * m = findMonitor({r.backend, r.monitor});
+            if (!m) continue;
+            if (!r.ok)
+            {
+                // the value stays missing and writes are held back until
+                // checkSleepingMonitors() finds it answering again
+                continue;
+            }
+
+            MonitorInfo & info = m->info;
+            if (r.code == Vcp::brightness)
+            {
+                info.currentBrightness = r.value;
+                info.maxBrightness = r.max;
+                if (brightness == 0) {
+                    brightness = (float) r.value / r.max;
                 }
             }
+            else
+            {
+                info.currentContrast = r.value;
+                info.maxContrast = r.max;
 
-            return true;
-        };
+                // "neutral" contrast level depends on settings
+                auto & defaultNeutral = settings.savedNeutralContrast;
+                auto pairIB = defaultNeutral.insert({info.name, r.max});
+                info.neutralContrast = pairIB.first->second;
 
-        EnumDisplayMonitors(NULL, NULL, monitorProc, reinterpret_cast<LPARAM>(this));
+                if (contrast == 0) {
+                    contrast = (float) r.value / info.neutralContrast;
+                }
+            }
+        }
     }
 
-public:
+    // Ask the monitors that were probed from the known model table for their
+    // capabilities after all. Done after the sliders work, at scheduled
+    // priority so a refresh() doesn't cancel it.
+    void verifyKnownModels()
+    {
+        std::vector<BusScheduler::Command> requests;
+        for (const auto & m : monitors)
+        {
+            if (m.knownModel) { requests.push_back(BusScheduler::capabilitiesOf(m.key.first, m.key.second, m.bus)); }
+        }
+        if (requests.empty()) return;
 
-    ~MonitorControlImpl()
+        scheduler.submit(std::move(requests), Priority::scheduled,
+            [this](std::vector<BusScheduler::Command> & done)
+            {
+                std::function<void()> wakeup;
+                {
+                    std::lock_guard<std::mutex> lock(completionMutex);
+                    for (auto & c : done)
+                    {
+                        if (c.ok && !c.cancelled) { completedReads.push_back({std::move(c), 0}); }
+                    }
+                    if (!completedReads.empty()) { wakeup = wakeupCallback; }
+                }
+                if (wakeup) { wakeup(); }
+            });
+    }
+
+    // returns true if the table entry was wrong
+    bool checkKnownModel(Monitor & m, const std::string & capStr)
     {
-        for (auto & data : physicalMonitorLists)
+        Capabilities caps;
+        if (!parseCapabilities(capStr, caps)) return false;
+
+        auto & info = m.info;
+        if (caps.doesBrightness == info.doesBrightness && caps.doesContrast == info.doesContrast &&
+            caps.doesPowerMode == m.doesPowerMode && caps.version == info.version)
         {
-            DestroyPhysicalMonitors(data.amount, data.list);
+            return false;
         }
+
+        // trust the monitor
+        applyCapabilities(m, caps);
+        if (m.info.poweredOn) { readValues({&m}); }
+        return true;
     }
 };
 
 
 MonitorControl * MonitorControl::create(Settings && settings)
 {
+    std::vector<std::unique_ptr<MonitorBackend>> backends;
+    const bool replay = !settings.replayTrace.empty();
+    if (replay)
+    {
+        // everything comes from the trace, no live monitor or panel is touched
+        backends = createReplayBackends(settings.replayTrace, settings.replayTimeScale);
+    }
+    else
+    {
+        // DDC/CI monitors
+        backends.push_back(createDdcBackend());
+
+        // internal laptop panels
+        std::wstring backlightPath = settings.backlightPath;
+#ifdef __linux__
+        if (backlightPath.empty()) { backlightPath = L"/sys/class/backlight"; }
+#endif
+        if (!backlightPath.empty())
+        {
+            backends.push_back(createBacklightBackend(backlightPath));
+        }
+    }
+    if (!settings.recordTrace.empty())
+    {
+        backends = createRecordingBackends(std::move(backends), settings.recordTrace);
+    }
+
+    const std::wstring sharedStateName = settings.sharedStateName;
+
     MonitorControlImpl * impl = new MonitorControlImpl(std::move(settings));
+    if (!sharedStateName.empty())
+    {
+        impl->publishStateTo(sharedStateName);
+    }
+    // a replay doesn't follow the real displays either
+    if (!replay) { impl->watchPower(); }
+    for (auto & backend : backends)
+    {
+        impl->addBackend(std::move(backend));
+    }
     impl->probe();
     return impl;
 }
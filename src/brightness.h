@@ -7,6 +7,9 @@ two files are available under GPLv3 and the MIT license.
 
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -18,6 +21,7 @@ public:
     struct MonitorInfo
     {
         std::wstring name;
+        std::string source;
         std::string version;
         bool doesBrightness = false;
         int currentBrightness = 0;
@@ -26,13 +30,127 @@ public:
         int currentContrast = 0;
         int maxContrast = 0;
         int neutralContrast = 0;
+        // false if the last command sent to it failed
+        bool responding = true;
+        // false while the monitor is in standby or switched off
+        bool poweredOn = true;
     };
 
     struct Settings
     {
         std::unordered_map<std::wstring, int> savedNeutralContrast;
+
+        // Dispatch the writes to all monitors concurrently and release them
+        // together, so a multi-monitor setup changes as one surface.
+        bool synchronizedUpdates = true;
+
+        // If set, log the traffic of all backends to this trace file.
+        std::wstring recordTrace;
+        // If set, don't talk to real monitors or panels but replay this trace
+        // file.
+        std::wstring replayTrace;
+        // Latency multiplier for replay. 0 answers immediately.
+        float replayTimeScale = 1.f;
+
+        // Directory with sysfs backlight panels. If empty, /sys/class/backlight
+        // is used on platforms that have it.
+        std::wstring backlightPath;
+
+        // Name of the shared memory segment where the current state is
+        // published for other processes, see state_segment.h. Empty disables it.
+        std::wstring sharedStateName;
+
+        // Monitor models in the built-in table (known_models.h) are probed
+        // without asking for their capabilities. If set, the capabilities are
+        // still fetched afterwards, and the monitor is corrected if they differ.
+        bool verifyKnownModels = true;
+    };
+
+    // Timing of the most recent brightness or contrast update.
+    struct UpdateStats
+    {
+        int monitorsWritten = 0;
+        // from releasing the writes until the last monitor acknowledged
+        double durationMs = 0;
+        // spread between the first and the last monitor acknowledging
+        double skewMs = 0;
+    };
+
+    // Monitor commands are scheduled in three classes. Interactive ones (the
+    // sliders) overtake scheduled ones (wake-up flushes, power checks), which
+    // overtake background work (refresh()).
+    enum class Priority
+    {
+        interactive,
+        scheduled,
+        background
+    };
+
+    // Time spent queued before the bus got to a batch of commands, per
+    // class. There is one sample per bus and batch, so the time a command
+    // waits for others of its own batch doesn't count.
+    struct QueueStats
+    {
+        struct Class
+        {
+            uint64_t samples = 0;
+            double totalWaitMs = 0;
+            double maxWaitMs = 0;
+        };
+
+        std::array<Class, 3> classes;
+
+        // interactive samples which waited longer than this
+        static constexpr double interactiveTargetMs = 100;
+        uint64_t interactiveTargetMisses = 0;
+    };
+
+    // Worker thread activity, to check that nothing runs while idle.
+    struct ActivityStats
+    {
+        int workerThreads = 0;
+        // times a worker woke up to run commands
+        uint64_t workerWakeups = 0;
+    };
+
+    // A change subscribers are told about, see subscribe().
+    struct Event
+    {
+        enum Type : uint8_t
+        {
+            valueApplied,   // a brightness or contrast write reached the monitor
+            monitorAdded,
+            healthChanged,  // `responding` or `poweredOn` changed
+            driftDetected,  // refresh() found a value changed on the monitor itself
+            overflow,       // `value` events were dropped before this one
+            // a monitor went away; not sent yet, monitors are only enumerated once
+            monitorRemoved
+        };
+
+        Type type = valueApplied;
+        // index in monitorList()
+        uint32_t monitor = 0;
+        // VCP code and value, for valueApplied and driftDetected
+        uint8_t code = 0;
+        int32_t value = 0;
+        bool responding = true;
+        bool poweredOn = true;
+    };
+
+    struct SubscriberOptions
+    {
+        // bits by Event::Type
+        uint32_t eventMask = ~0u;
+        // Events that don't fit are dropped, and counted in an overflow event
+        // once there is room again.
+        size_t capacity = 256;
+        // If set, called from handleCompletions(). Otherwise take the events
+        // with pollEvent().
+        std::function<void(const Event &)> callback;
     };
 
+    using SubscriberId = int;
+
     static MonitorControl * create(Settings && settings);
     virtual ~MonitorControl();
 
@@ -49,6 +167,43 @@ public:
 
     virtual std::vector<MonitorInfo> monitorList() = 0;
 
+    virtual UpdateStats lastUpdateStats() const = 0;
+    virtual QueueStats queueStats() const = 0;
+    virtual ActivityStats activityStats() const = 0;
+
+    // Stop the worker threads that have nothing to do and free what was only
+    // needed while monitors were being changed. They come back on demand.
+    virtual void releaseIdleResources() = 0;
+
+    // Re-read the current values in the background, to catch changes made
+    // with the monitor's own buttons. Cancels an earlier refresh that is
+    // still queued.
+    virtual void refresh() = 0;
+
+    // Background work finishes on other threads. When it does, `callback` is
+    // called (from any thread) and the owner should call handleCompletions()
+    // on the thread that uses this object.
+    virtual void setWakeupCallback(std::function<void()> callback) = 0;
+    virtual void handleCompletions() = 0;
+
+    // The OS reports all displays were switched on or off. This is hooked up
+    // automatically where the platform supports it.
+    virtual void displayPowerChanged(bool on) = 0;
+
+    // Subscribe to change events. A new subscriber first gets a monitorAdded
+    // event for every monitor. Call these on the thread that uses this object.
+    virtual SubscriberId subscribe(SubscriberOptions options) = 0;
+    virtual void unsubscribe(SubscriberId id) = 0;
+
+    // For subscribers without a callback. Both can be called from another
+    // thread, but only from one thread per subscriber.
+    virtual bool pollEvent(SubscriberId id, Event & event) = 0;
+    // Signalled while events may be waiting: an event HANDLE on Windows, an
+    // eventfd elsewhere, -1 if there is none. After it fires, call
+    // pollEvent() until it returns false. Only valid in this process, other
+    // processes can wait for the shared state instead, see state_segment.h.
+    virtual intptr_t readinessHandle(SubscriberId id) = 0;
+
 protected:
     MonitorControl();
 };
@@ -0,0 +1,160 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#include "events.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+
+EventQueue::EventQueue(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity) { size *= 2; }
+    slots.resize(size);
+    mask = size - 1;
+}
+
+
+bool EventQueue::push(const Event & e)
+{
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask) return false;
+
+    slots[t & mask] = e;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+
+size_t EventQueue::space() const
+{
+    return slots.size() - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+}
+
+
+bool EventQueue::pop(Event & e)
+{
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+
+    e = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+
+#ifdef _WIN32
+
+ReadinessSignal::ReadinessSignal()
+    : native((intptr_t) CreateEventW(NULL, FALSE, FALSE, NULL))
+{
+    if (!native) { native = -1; }
+}
+
+ReadinessSignal::~ReadinessSignal()
+{
+    if (native != -1) { CloseHandle((HANDLE) native); }
+}
+
+void ReadinessSignal::set()
+{
+    if (native != -1) { SetEvent((HANDLE) native); }
+}
+
+void ReadinessSignal::clear()
+{
+    if (native != -1) { ResetEvent((HANDLE) native); }
+}
+
+#elif defined(__linux__)
+
+ReadinessSignal::ReadinessSignal()
+    : native(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{}
+
+ReadinessSignal::~ReadinessSignal()
+{
+    if (native != -1) { close((int) native); }
+}
+
+void ReadinessSignal::set()
+{
+    const uint64_t one = 1;
+    if (native != -1) { (void) !write((int) native, &one, sizeof(one)); }
+}
+
+void ReadinessSignal::clear()
+{
+    uint64_t count;
+    if (native != -1) { (void) !read((int) native, &count, sizeof(count)); }
+}
+
+#else
+
+ReadinessSignal::ReadinessSignal() : native(-1) {}
+ReadinessSignal::~ReadinessSignal() {}
+void ReadinessSignal::set() {}
+void ReadinessSignal::clear() {}
+
+#endif
+
+
+EventSubscriber::EventSubscriber(MonitorControl::SubscriberOptions subscriberOptions)
+    : options(std::move(subscriberOptions)),
+    queue(options.capacity)
+{
+    if (!options.callback) { signal = std::make_unique<ReadinessSignal>(); }
+}
+
+
+bool EventSubscriber::post(const Event & e)
+{
+    if (!wants(e.type)) return false;
+
+    // tell the consumer where it lost events before anything newer
+    if (dropped)
+    {
+        if (queue.space() < 2)
+        {
+            ++dropped;
+            return false;
+        }
+        Event marker;
+        marker.type = Event::overflow;
+        marker.value = (int32_t) dropped;
+        queue.push(marker);
+        dropped = 0;
+    }
+
+    if (!queue.push(e))
+    {
+        ++dropped;
+        return false;
+    }
+    if (signal) { signal->set(); }
+    return true;
+}
+
+
+bool EventSubscriber::poll(Event & e)
+{
+    if (queue.pop(e)) return true;
+
+    // Clear before looking again, so an event posted in between either shows
+    // up now or sets the signal again.
+    if (signal) { signal->clear(); }
+    return queue.pop(e);
+}
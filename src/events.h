@@ -0,0 +1,88 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include "brightness.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+// Bounded single-producer single-consumer queue. The thread that uses
+// MonitorControl produces, the subscriber consumes, neither ever blocks.
+class EventQueue
+{
+public:
+    using Event = MonitorControl::Event;
+
+    // capacity is rounded up to a power of two
+    explicit EventQueue(size_t capacity);
+
+    // producer side, false if the queue is full
+    bool push(const Event & e);
+    // room left, as seen by the producer
+    size_t space() const;
+
+    // consumer side, false if the queue is empty
+    bool pop(Event & e);
+
+private:
+    std::vector<Event> slots;
+    size_t mask;
+    // separate cache lines, the two ends are written by different threads
+    alignas(64) std::atomic<size_t> head{0};   // next to pop
+    alignas(64) std::atomic<size_t> tail{0};   // next to push
+};
+
+
+// Signalled while events may be waiting: an auto-reset event on Windows, an
+// eventfd on Linux. Elsewhere there is no handle.
+class ReadinessSignal
+{
+public:
+    ReadinessSignal();
+    ~ReadinessSignal();
+
+    void set();
+    void clear();
+    intptr_t handle() const { return native; }
+
+private:
+    intptr_t native;
+};
+
+
+class EventSubscriber
+{
+public:
+    using Event = MonitorControl::Event;
+
+    explicit EventSubscriber(MonitorControl::SubscriberOptions options);
+
+    const MonitorControl::SubscriberOptions options;
+
+    bool wants(Event::Type type) const { return (options.eventMask & (1u << type)) != 0; }
+
+    // Producer side. Returns false if the event was dropped.
+    bool post(const Event & e);
+
+    // Consumer side.
+    bool poll(Event & e);
+    intptr_t readinessHandle() const { return signal ? signal->handle() : -1; }
+
+private:
+    EventQueue queue;
+    // only for subscribers that poll
+    std::unique_ptr<ReadinessSignal> signal;
+    // dropped since the last overflow event, producer side
+    uint32_t dropped = 0;
+};
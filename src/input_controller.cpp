@@ -0,0 +1,166 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#include "input_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+
+using Seconds = std::chrono::duration<double>;
+
+
+InputController::InputController(
+    std::function<void(float)> sendFunction,
+    std::function<Clock::time_point()> nowFunction)
+    : InputController(std::move(sendFunction), std::move(nowFunction), Tuning())
+{}
+
+
+InputController::InputController(
+    std::function<void(float)> sendFunction,
+    std::function<Clock::time_point()> nowFunction,
+    Tuning t)
+    : send(std::move(sendFunction)), now(std::move(nowFunction)), tuning(t)
+{}
+
+
+void InputController::setRange(float newMinimum, float newMaximum)
+{
+    minimum = newMinimum;
+    maximum = newMaximum;
+}
+
+
+void InputController::reset(float value)
+{
+    current = value;
+    lastSent = value;
+    dragging = false;
+    throttling = false;
+}
+
+
+void InputController::dragStarted()
+{
+    dragging = true;
+    velocity = 0;
+    deceleration = 0;
+    peakSpeed = 0;
+    lastSampleTime = now();
+    sampledValue = current;
+}
+
+
+void InputController::sample(float value, Clock::time_point t)
+{
+    const double dt = Seconds(t - lastSampleTime).count();
+    if (dt <= 0)
+    {
+        // several events in one tick, the next sample covers them
+        return;
+    }
+
+    const double alpha = 1 - std::exp(-dt / Seconds(tuning.smoothing).count());
+    const double previous = velocity;
+    velocity += alpha * ((value - sampledValue) / dt - velocity);
+
+    // positive while the speed goes down
+    const double speedDrop = (std::abs(previous) - std::abs(velocity)) / dt;
+    deceleration += alpha * (speedDrop - deceleration);
+
+    peakSpeed = std::max(peakSpeed, std::abs(velocity));
+    lastSampleTime = t;
+    sampledValue = value;
+}
+
+
+// the estimate fades out once the pointer stops sending moves
+double InputController::velocityAt(Clock::time_point t) const
+{
+    const double idle = Seconds(t - lastSampleTime).count();
+    return velocity * std::exp(-std::max(0.0, idle) / Seconds(tuning.smoothing).count());
+}
+
+
+// where the value is expected to come to rest
+float InputController::target(Clock::time_point t) const
+{
+    // a pointer that stopped sending moves a while ago is held still
+    if (!dragging || t - lastSampleTime > 3 * tuning.smoothing) return current;
+
+    const double v = velocityAt(t);
+    const double range = maximum - minimum;
+    // the smoothed velocity trails the pointer by about one time constant
+    const double speed = std::abs(v) - deceleration * Seconds(tuning.smoothing).count();
+    const bool slowingDown = deceleration > 0 && speed > tuning.restingSpeed * range
+        && std::abs(v) < tuning.slowDownRatio * peakSpeed;
+    if (!slowingDown) return current;
+
+    // constant deceleration stops after v² / 2a
+    const double maxLead = tuning.maxLead * range;
+    const double lead = std::min(maxLead, speed * speed / (2 * deceleration));
+    const double predicted = current + (v > 0 ? lead : -lead);
+    return (float) std::clamp(predicted, (double) minimum, (double) maximum);
+}
+
+
+void InputController::sendValue(float value, Clock::time_point t)
+{
+    lastSendTime = t;
+    throttling = true;
+    if (value == lastSent) return;
+
+    lastSent = value;
+    send(value);
+}
+
+
+void InputController::moved(float value)
+{
+    const auto t = now();
+    if (dragging) { sample(value, t); }
+    current = value;
+
+    // the first change after a pause goes out right away
+    if (!throttling || t - lastSendTime >= tuning.minInterval)
+    {
+        sendValue(target(t), t);
+    }
+}
+
+
+void InputController::released(float value)
+{
+    const auto t = now();
+    dragging = false;
+    current = value;
+    velocity = 0;
+    deceleration = 0;
+    peakSpeed = 0;
+
+    if (pending()) { sendValue(value, t); }
+}
+
+
+void InputController::update()
+{
+    const auto t = now();
+    if (t - lastSendTime < tuning.minInterval) return;
+    if (pending()) { sendValue(target(t), t); }
+    else { throttling = false; }
+}
+
+
+InputController::Duration InputController::nextUpdate() const
+{
+    if (!pending()) return Duration(-1);
+    return std::max(Duration(0), tuning.minInterval - Duration(now() - lastSendTime));
+}
@@ -0,0 +1,96 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+
+// Turns the positions of a slider into monitor writes. Every write takes a
+// DDC/CI round trip, so during a drag they are spaced at least `minInterval`
+// apart. To make up for that, a drag that slows down gets the value it is
+// expected to come to rest at, rather than where the pointer happens to be.
+// The value at release is always sent exactly.
+//
+// The clock is passed in, so the behaviour can be run in virtual time.
+class InputController
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Duration = std::chrono::duration<double, std::milli>;
+
+    struct Tuning
+    {
+        // least time between two writes while the value keeps changing
+        Duration minInterval{250};
+        // time constant of the velocity and deceleration estimates
+        Duration smoothing{40};
+        // a drag is slowing down once its speed is below this fraction of
+        // the highest speed in this drag
+        double slowDownRatio = .75;
+        // the furthest a prediction may lead the actual value, as a fraction
+        // of the range
+        double maxLead = .1;
+        // below this speed, in fractions of the range per second, the drag
+        // has come to rest and there is nothing left to predict
+        double restingSpeed = .01;
+    };
+
+    explicit InputController(
+        std::function<void(float)> send,
+        std::function<Clock::time_point()> now = Clock::now);
+    InputController(
+        std::function<void(float)> send,
+        std::function<Clock::time_point()> now,
+        Tuning tuning);
+
+    // predictions stay within this range
+    void setRange(float minimum, float maximum);
+    // the monitors are at `value` now, without sending it
+    void reset(float value);
+
+    void dragStarted();
+    // the value changed, by a drag or otherwise
+    void moved(float value);
+    // the drag ended at `value`
+    void released(float value);
+
+    // Sends what is due. Call it once nextUpdate() has passed.
+    void update();
+    // time until update() has something to do, negative if nothing is pending
+    Duration nextUpdate() const;
+
+private:
+    const std::function<void(float)> send;
+    const std::function<Clock::time_point()> now;
+    const Tuning tuning;
+    float minimum = 0, maximum = 1;
+
+    float current = 0;
+    float lastSent = 0;
+    Clock::time_point lastSendTime;
+    // writes are being spaced out, until one finds nothing left to send
+    bool throttling = false;
+
+    bool dragging = false;
+    Clock::time_point lastSampleTime;
+    // the value at lastSampleTime, `current` may have moved on since
+    float sampledValue = 0;
+    // value units per second, and per second squared
+    double velocity = 0;
+    double deceleration = 0;
+    double peakSpeed = 0;
+
+    void sample(float value, Clock::time_point t);
+    double velocityAt(Clock::time_point t) const;
+    float target(Clock::time_point t) const;
+    void sendValue(float value, Clock::time_point t);
+    bool pending() const { return current != lastSent; }
+};
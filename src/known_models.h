@@ -0,0 +1,179 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Monitor models whose capabilities we already know, so probing them can skip
+// the capabilities request, which is by far the slowest DDC/CI command. The
+// lookup table is a perfect hash, built by the compiler.
+
+struct KnownModel
+{
+    // EDID manufacturer and product code, as in MonitorBackend::PhysicalMonitor::model
+    const char * id;
+    const char * mccsVersion;
+    bool doesBrightness;
+    bool doesContrast;
+    bool doesPowerMode;
+};
+
+// knownModels, generated from data/known_models.csv by cmake/KnownModels.cmake.
+// Only add models whose capabilities string was checked on the actual
+// monitor, for example from a trace recorded with --record-trace. A wrong entry
+// is corrected by the background check, but until then we may send it commands
+// it doesn't know, or leave out ones it does.
+#include "known_models_data.h"
+
+
+constexpr uint32_t modelHash(const char * id, uint32_t seed)
+{
+    // FNV-1a, with the seed mixed into the basis
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (; *id; ++id)
+    {
+        h = (h ^ (uint8_t) *id) * 16777619u;
+    }
+    // the low bits of FNV hardly depend on the seed, and the table sizes take those
+    return h ^ (h >> 16);
+}
+
+
+constexpr bool sameModelId(const char * a, const char * b)
+{
+    for (; *a && *a == *b; ++a, ++b) {}
+    return *a == *b;
+}
+
+
+// Hash and displace: the models are spread over buckets with one hash, then
+// every bucket gets its own seed for a second hash that puts each of its
+// models in a free slot.
+template <size_t N>
+struct KnownModelTable
+{
+    static constexpr size_t buckets = N ? N : 1;
+    // twice the entries keeps the seed searches short
+    static constexpr size_t size = N ? 2 * N : 1;
+
+    bool complete = false;
+    std::array<uint32_t, buckets> seeds{};
+    // index in knownModels + 1, 0 for empty
+    std::array<uint16_t, size> slots{};
+
+    static constexpr size_t bucketOf(const char * id) { return modelHash(id, 0) % buckets; }
+    constexpr size_t slotOf(const char * id) const { return modelHash(id, seeds[bucketOf(id)]) % size; }
+};
+
+
+template <size_t N>
+constexpr KnownModelTable<N> buildKnownModelTable(const std::array<KnownModel, N> & models)
+{
+    using Table = KnownModelTable<N>;
+    Table table;
+
+    std::array<size_t, Table::buckets> bucketSize{};
+    for (size_t i = 0; i < N; ++i) { ++bucketSize[Table::bucketOf(models[i].id)]; }
+
+    // the biggest buckets are the hardest to place, do them first
+    for (size_t count = N; count > 0; --count)
+    {
+        for (size_t b = 0; b < Table::buckets; ++b)
+        {
+            if (bucketSize[b] != count) continue;
+
+            bool placed = false;
+            for (uint32_t seed = 1; seed < 10000 && !placed; ++seed)
+            {
+                auto slots = table.slots;
+                placed = true;
+                for (size_t i = 0; i < N && placed; ++i)
+                {
+                    if (Table::bucketOf(models[i].id) != b) continue;
+                    auto & slot = slots[modelHash(models[i].id, seed) % Table::size];
+                    placed = slot == 0;
+                    slot = (uint16_t) (i + 1);
+                }
+                if (placed)
+                {
+                    table.slots = slots;
+                    table.seeds[b] = seed;
+                }
+            }
+            if (!placed) return table;
+        }
+    }
+
+    table.complete = true;
+    return table;
+}
+
+
+template <size_t N>
+constexpr const KnownModel * lookupKnownModel(
+    const std::array<KnownModel, N> & models, const KnownModelTable<N> & table, const char * id)
+{
+    if (N == 0 || !*id) return nullptr;
+    const uint16_t slot = table.slots[table.slotOf(id)];
+    if (slot == 0) return nullptr;
+    const KnownModel & model = models[slot - 1];
+    return sameModelId(model.id, id) ? &model : nullptr;
+}
+
+
+template <size_t N>
+constexpr bool findsAllKnownModels(const std::array<KnownModel, N> & models, const KnownModelTable<N> & table)
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (lookupKnownModel(models, table, models[i].id) != &models[i]) return false;
+    }
+    return true;
+}
+
+
+// self-test of the table construction and lookup, on made up models
+constexpr std::array<KnownModel, 6> knownModelSamples{{
+    {"AAA0001", "2.1", true, true, false},
+    {"AAA0002", "2.2", true, true, true},
+    {"BBB1234", "2.2", true, false, true},
+    {"CCC00A1", "3.0", true, true, true},
+    {"DDD9999", "2.0", false, true, false},
+    {"EEE5050", "2.2", true, true, true},
+}};
+constexpr auto knownModelSampleTable = buildKnownModelTable(knownModelSamples);
+static_assert(knownModelSampleTable.complete, "no perfect hash for the sample models");
+static_assert(findsAllKnownModels(knownModelSamples, knownModelSampleTable), "known model lookup misses an entry");
+static_assert(!lookupKnownModel(knownModelSamples, knownModelSampleTable, "ZZZ0000") &&
+    !lookupKnownModel(knownModelSamples, knownModelSampleTable, "AAA000") &&
+    !lookupKnownModel(knownModelSamples, knownModelSampleTable, ""),
+    "known model lookup finds an unknown id");
+// two models in one bucket, which needs the seed in the low bits of the hash
+constexpr std::array<KnownModel, 2> knownModelPair{{
+    {"AAA0001", "2.1", true, true, false},
+    {"BBB1234", "2.2", true, false, true},
+}};
+static_assert(buildKnownModelTable(knownModelPair).complete, "no perfect hash for two models");
+
+
+constexpr auto knownModelTable = buildKnownModelTable(knownModels);
+static_assert(knownModelTable.complete, "no perfect hash for knownModels, is there a duplicate id?");
+static_assert(findsAllKnownModels(knownModels, knownModelTable), "known model lookup misses an entry");
+
+
+// nullptr for models that aren't in the list
+inline const KnownModel * findKnownModel(const std::string & id)
+{
+    return lookupKnownModel(knownModels, knownModelTable, id.c_str());
+}
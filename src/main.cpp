@@ -17,6 +17,9 @@ You should have received a copy of the GNU General Public License along
 with Monitor Brightness Control. If not, see <https://www.gnu.org/licenses/>.
 */
 #include "brightness.h"
+#include "input_controller.h"
+#include "resource_usage.h"
+#include "state_segment.h"
 
 #include <memory>
 #include <juce_gui_extra/juce_gui_extra.h>
@@ -27,6 +30,37 @@ using namespace juce;
 MonitorControl * monitorcontrolInstance();
 
 
+// Decoded once at startup, instead of every time an icon is set or the
+// callout opens.
+struct SharedImages
+{
+    Image icon16, icon32;
+    // shown while the monitors are probed
+    Image icon16Loading, icon32Loading;
+    Image silhouette;
+    Image reset;
+
+    SharedImages()
+    {
+        icon16 = ImageFileFormat::loadFrom(BinaryData::brightness16_png, BinaryData::brightness16_pngSize);
+        icon32 = ImageFileFormat::loadFrom(BinaryData::brightness32_png, BinaryData::brightness32_pngSize);
+        icon16Loading = icon16.createCopy();
+        icon16Loading.multiplyAllAlphas(.7f);
+        icon32Loading = icon32.createCopy();
+        icon32Loading.multiplyAllAlphas(.7f);
+        silhouette = ImageFileFormat::loadFrom(BinaryData::brightnesssilhouette_png, BinaryData::brightnesssilhouette_pngSize);
+        reset = ImageFileFormat::loadFrom(BinaryData::reset_png, BinaryData::reset_pngSize);
+    }
+};
+
+const SharedImages & sharedImages();
+
+
+// Times we woke up the message thread ourselves (timers, completions), for
+// the idle measurements. Only touched on the message thread.
+static uint64_t messageThreadWakeups = 0;
+
+
 juce::String U8(const char * ch)
 {
     return juce::CharPointer_UTF8(ch);
@@ -57,24 +91,18 @@ public:
         brightnessLabel("Brightness", "Brightness"),
         contrastLabel("Contrast","Contrast")
     {
-        auto * mc = monitorcontrolInstance();
         setSize(250, 80);
         brightnessSlider.setRange(0, 1, 0.01);
         brightnessSlider.setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
-        contrastSlider.setRange(0, mc->getMaxContrast(), 0.01);
         contrastSlider.setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
-
-        brightnessSlider.setValue(mc->getBrightness(), juce::dontSendNotification);
-        contrastSlider.setValue(mc->getContrast(), juce::dontSendNotification);
-        brightnessValueLabel.setText(percentText(mc->getBrightness()), dontSendNotification);
-        contrastValueLabel.setText(percentText(mc->getContrast()), dontSendNotification);
+        syncFromControl();
 
         brightnessValueLabel.setBorderSize(BorderSize<int>(0));
         brightnessValueLabel.setColour(Label::textColourId, Colours::white.darker());
         contrastValueLabel.setBorderSize(BorderSize<int>(0));
         contrastValueLabel.setColour(Label::textColourId, Colours::white.darker());
 
-        Image resetImg = ImageCache::getFromMemory(BinaryData::reset_png, BinaryData::reset_pngSize);
+        const Image & resetImg = sharedImages().reset;
         
         brightnessSlider.addListener(this);
         contrastSlider.addListener(this);
@@ -112,6 +140,31 @@ public:
         addAndMakeVisible(contrastButton);
     }
 
+    // the component is kept between callouts, pick up the current values
+    void syncFromControl()
+    {
+        // still sending the last change, the sliders are ahead of the monitors
+        if (isTimerRunning()) return;
+
+        auto * mc = monitorcontrolInstance();
+        contrastSlider.setRange(0, mc->getMaxContrast(), 0.01);
+        contrastInput.setRange(0, mc->getMaxContrast());
+        brightnessInput.reset(mc->getBrightness());
+        contrastInput.reset(mc->getContrast());
+        brightnessSlider.setValue(mc->getBrightness(), juce::dontSendNotification);
+        contrastSlider.setValue(mc->getContrast(), juce::dontSendNotification);
+        brightnessValueLabel.setText(percentText(mc->getBrightness()), dontSendNotification);
+        contrastValueLabel.setText(percentText(mc->getContrast()), dontSendNotification);
+    }
+
+    // called when the callout box goes away
+    std::function<void()> onClose;
+
+    void parentHierarchyChanged() override
+    {
+        if (getParentComponent() == nullptr && onClose) { onClose(); }
+    }
+
     void buttonClicked(Button *b) override
     {
         if (b == &contrastButton) {
@@ -119,51 +172,56 @@ public:
         }
     }
 
+    InputController * inputFor(Slider * s)
+    {
+        return s == &brightnessSlider ? &brightnessInput : s == &contrastSlider ? &contrastInput : nullptr;
+    }
+
+    void sliderDragStarted(Slider *s) override
+    {
+        if (auto * input = inputFor(s)) { input->dragStarted(); }
+    }
+
+    void sliderDragEnded(Slider *s) override
+    {
+        if (auto * input = inputFor(s)) { input->released((float) s->getValue()); }
+        scheduleUpdate();
+    }
+
     void sliderValueChanged(Slider *s) override
     {
         if (s == &brightnessSlider) {
-            updateBrightness = true;
             brightnessValueLabel.setText(percentText(brightnessSlider.getValue()), dontSendNotification);
             repaint();
         }
         else if (s == &contrastSlider) {
-            updateContrast = true;
             contrastValueLabel.setText(percentText(contrastSlider.getValue()), dontSendNotification);
             repaint();
         }
-        if (updateBrightness || updateContrast) {
-            // the first settings update is immediate, but later ones are
-            // throttled by a timer to 4 per second.
-            if (!isTimerRunning()) {
-                doSettings();
-                startTimer(250);
-            }
-        }
+        if (auto * input = inputFor(s)) { input->moved((float) s->getValue()); }
+        scheduleUpdate();
     }
 
-    void timerCallback() override
+    // the timer only runs while one of the inputs has something to send
+    void scheduleUpdate()
     {
-        if (updateBrightness || updateContrast) {
-            // update was requested, apply updates and do another tick
-            doSettings();
+        const double b = brightnessInput.nextUpdate().count();
+        const double c = contrastInput.nextUpdate().count();
+        const double next = b < 0 ? c : c < 0 ? b : std::min(b, c);
+        if (next < 0) {
+            stopTimer();
         }
         else {
-            // no updates since the last tick, stop timer
-            stopTimer();
+            startTimer(std::max(1, (int) std::ceil(next)));
         }
     }
 
-    void doSettings()
+    void timerCallback() override
     {
-        if (updateBrightness) {
-            monitorcontrolInstance()->setBrightness((float)brightnessSlider.getValue());
-        }
-        if (updateContrast) {
-            monitorcontrolInstance()->setContrast((float)contrastSlider.getValue());
-        }
-
-        updateBrightness = false;
-        updateContrast = false;
+        ++messageThreadWakeups;
+        brightnessInput.update();
+        contrastInput.update();
+        scheduleUpdate();
     }
 
     Label brightnessLabel;
@@ -173,9 +231,10 @@ public:
     Label contrastValueLabel;
     Slider contrastSlider;
     ImageButton contrastButton;
-    bool updateBrightness = false;
-    bool updateContrast = false;
     bool focusFlag = false;
+
+    InputController brightnessInput{[](float v) { monitorcontrolInstance()->setBrightness(v); }};
+    InputController contrastInput{[](float v) { monitorcontrolInstance()->setContrast(v); }};
 };
 
 
@@ -183,7 +242,8 @@ void showInfo();
 void editNeutralContrast();
 
 
-class OurSystemTrayIconComponent : public SystemTrayIconComponent
+class OurSystemTrayIconComponent : public SystemTrayIconComponent,
+    Timer
 {
 public:
     OurSystemTrayIconComponent()
@@ -195,6 +255,22 @@ public:
     void onLoad()
     {
         setIcon(monitorcontrolInstance()->hasAnySupportedMonitors());
+        goIdle();
+    }
+
+    // Once nothing happened for a while, give back the worker threads and
+    // memory. A single timer tick, so we don't keep waking up.
+    void goIdle()
+    {
+        startTimer(5000);
+    }
+
+    void timerCallback() override
+    {
+        ++messageThreadWakeups;
+        stopTimer();
+        if (auto * mc = monitorcontrolInstance()) { mc->releaseIdleResources(); }
+        trimWorkingSet();
     }
 
     void setIcon(bool finishedLoading)
@@ -204,19 +280,13 @@ public:
         // transparency properly so the icons also have either 0 or 100% alpha.
         // Ideally we should of course get a layer directly from our ICO resource but JUCE doesn't expose
         // this functionality.
+        const auto & images = sharedImages();
         float dpiScale = Desktop::getInstance().getGlobalScaleFactor();
-        auto img = (dpiScale <= 1.00f) ?
-            ImageFileFormat::loadFrom(BinaryData::brightness16_png, BinaryData::brightness16_pngSize) :
-            ImageFileFormat::loadFrom(BinaryData::brightness32_png, BinaryData::brightness32_pngSize);
-
-        const auto templateImg = ImageFileFormat::loadFrom(BinaryData::brightnesssilhouette_png, BinaryData::brightnesssilhouette_pngSize);
+        const Image & img = (dpiScale <= 1.00f) ?
+            (finishedLoading ? images.icon16 : images.icon16Loading) :
+            (finishedLoading ? images.icon32 : images.icon32Loading);
 
-        if (!finishedLoading)
-        {
-            img.multiplyAllAlphas(.7f);
-        }
-
-        setIconImage(img, templateImg);
+        setIconImage(img, images.silhouette);
     }
 
     virtual void mouseDown(const MouseEvent &e) override
@@ -255,9 +325,25 @@ public:
         }
         else
         {
-            std::unique_ptr<Component> content;
+            const auto pos = e.source.getScreenPosition().roundToInt();
+            juce::Rectangle<int> mouseRect(pos.x, pos.y, 1, 1);
+            stopTimer();
+
             if (supported) {
-                content = std::make_unique<OurCalloutContent>();
+                // pick up changes made with the monitors' own buttons
+                monitorcontrolInstance()->refresh();
+
+                // the content outlives the box, so opening it again is cheap
+                if (!callout) {
+                    callout = std::make_unique<OurCalloutContent>();
+                    callout->onClose = [this]() { goIdle(); };
+                }
+                else {
+                    callout->syncFromControl();
+                }
+                auto * box = new CallOutBox(*callout, mouseRect, nullptr);
+                box->setAlwaysOnTop(true);
+                box->enterModalState(true, nullptr, true);
             }
             else {
                 auto label = std::make_unique<Label>("", "No supported monitors");
@@ -265,15 +351,55 @@ public:
                 label->setSize(
                     30 + label->getFont().getStringWidth(label->getText()),
                     22 + (int) label->getFont().getHeight());
-                content = std::move(label);
+                CallOutBox& myBox
+                    = CallOutBox::launchAsynchronously(std::move(label), mouseRect, nullptr);
+                myBox.setAlwaysOnTop(true);
             }
-            const auto pos = e.source.getScreenPosition().roundToInt();
-            juce::Rectangle<int> mouseRect(pos.x, pos.y, 1, 1);
-            CallOutBox& myBox
-                = CallOutBox::launchAsynchronously(std::move(content), mouseRect, nullptr);
-            myBox.setAlwaysOnTop(true);
         }
     }
+
+private:
+    std::unique_ptr<OurCalloutContent> callout;
+};
+
+
+// --idle-report=file.csv appends the resource usage to a file every minute,
+// to check what we cost while sitting in the tray. Its own timer counts as
+// one of the message thread wakeups.
+class IdleReport : public Timer
+{
+public:
+    explicit IdleReport(const File & reportFile)
+        : file(reportFile)
+    {
+        if (!file.existsAsFile())
+        {
+            file.appendText("seconds,working set KiB,peak working set KiB,cpu ms,worker threads,worker wakeups,message thread wakeups\n");
+        }
+        startTimer(60 * 1000);
+    }
+
+    void timerCallback() override
+    {
+        ++messageThreadWakeups;
+        const auto usage = currentResourceUsage();
+        MonitorControl::ActivityStats activity;
+        if (auto * mc = monitorcontrolInstance()) { activity = mc->activityStats(); }
+
+        String line;
+        line << String((Time::getMillisecondCounter() - started) / 1000) << ","
+            << String((int64) usage.workingSetBytes / 1024) << ","
+            << String((int64) usage.peakWorkingSetBytes / 1024) << ","
+            << String(roundToInt(usage.cpuSeconds * 1000)) << ","
+            << activity.workerThreads << ","
+            << String((int64) activity.workerWakeups) << ","
+            << String((int64) messageThreadWakeups) << "\n";
+        file.appendText(line);
+    }
+
+private:
+    File file;
+    const uint32 started = Time::getMillisecondCounter();
 };
 
 
@@ -315,6 +441,7 @@ public:
 
         LookAndFeel::setDefaultLookAndFeel(lookAndFeel.get());
 
+        images = std::make_unique<SharedImages>();
         icon = std::make_unique<OurSystemTrayIconComponent>();
 
         // asynchronously start our monitor control instance
@@ -325,6 +452,7 @@ public:
                 settings.setStorageParameters(sOptions);
 
                 MonitorControl::Settings mcSettings;
+                mcSettings.sharedStateName = SHARED_STATE_SEGMENT_NAME;
                 auto * userSettings = settings.getUserSettings();
                 if (userSettings)
                 {
@@ -336,16 +464,55 @@ public:
                         const int refContrast = userSettings->getIntValue("monitorRefContrast" + String(i));
                         mcSettings.savedNeutralContrast[monitorName.toUTF16().getAddress()] = refContrast;
                     }
+                    mcSettings.synchronizedUpdates = userSettings->getBoolValue("synchronizedUpdates", true);
+                }
+
+                // --record-trace=file.ddct logs all monitor traffic, --replay-trace=file.ddct
+                // serves it back instead of talking to real monitors.
+                ArgumentList args(getApplicationName(), getCommandLineParameterArray());
+                if (args.containsOption("--record-trace"))
+                {
+                    mcSettings.recordTrace = args.getValueForOption("--record-trace").toWideCharPointer();
+                }
+                if (args.containsOption("--replay-trace"))
+                {
+                    mcSettings.replayTrace = args.getValueForOption("--replay-trace").toWideCharPointer();
+                }
+                if (args.containsOption("--replay-time-scale"))
+                {
+                    mcSettings.replayTimeScale = args.getValueForOption("--replay-time-scale").getFloatValue();
+                }
+                // --backlight-path=dir looks for laptop panels there instead of
+                // /sys/class/backlight, where that exists.
+                if (args.containsOption("--backlight-path"))
+                {
+                    mcSettings.backlightPath = args.getValueForOption("--backlight-path").toWideCharPointer();
+                }
+                if (args.containsOption("--idle-report"))
+                {
+                    idleReport = std::make_unique<IdleReport>(
+                        File::getCurrentWorkingDirectory().getChildFile(args.getValueForOption("--idle-report")));
                 }
 
                 monitorcontrol.reset(MonitorControl::create(std::move(mcSettings)));
+                monitorcontrol->setWakeupCallback([]()
+                {
+                    MessageManager::callAsync([]()
+                    {
+                        ++messageThreadWakeups;
+                        if (auto * mc = monitorcontrolInstance()) { mc->handleCompletions(); }
+                    });
+                });
                 icon->onLoad();
             });
     }
 
     void shutdown() override
     {
+        idleReport = nullptr;
         icon = nullptr;
+        monitorcontrol = nullptr;
+        images = nullptr;
         lookAndFeel = nullptr;
     }
 
@@ -384,10 +551,18 @@ public:
         return *instance().lookAndFeel.get();
     }
 
+
+    static const SharedImages & imagesInstance()
+    {
+        return *instance().images.get();
+    }
+
 private:
+    std::unique_ptr<SharedImages> images;
     std::unique_ptr<OurSystemTrayIconComponent> icon;
     std::unique_ptr<LookAndFeel> lookAndFeel;
     std::unique_ptr<MonitorControl> monitorcontrol;
+    std::unique_ptr<IdleReport> idleReport;
     ApplicationProperties settings;
 };
 
@@ -398,6 +573,12 @@ MonitorControl * monitorcontrolInstance()
 }
 
 
+const SharedImages & sharedImages()
+{
+    return MonitorControlApplication::imagesInstance();
+}
+
+
 // actions
 
 void showInfo()
@@ -423,6 +604,7 @@ void showInfo()
         editor->insertTextAtCaret("\n");
 
         juce::String text;
+        text << U8(" • Connection: ") << m.source.c_str() << "\n";
         text << U8(" • MCCS version: ") << U8(m.version.empty() ? u8"—" : m.version.c_str()) << "\n";
         text << U8(" • Brightness supported: ") << (m.doesBrightness ? "Yes" : "No");
         if (m.doesBrightness) { text << " (0 - " << m.maxBrightness << ")"; }
@@ -433,10 +615,56 @@ void showInfo()
             text << " (0 - " << m.maxContrast << ") / " << m.neutralContrast;
         }
         text << "\n";
+        if (!m.poweredOn)
+        {
+            text << U8(" • In standby, changes are sent when it wakes up\n");
+        }
         editor->setFont(font);
         editor->insertTextAtCaret(juce::String(text));
     }
 
+    const auto stats = mc->lastUpdateStats();
+    if (stats.monitorsWritten > 0)
+    {
+        juce::String text;
+        text << "\nLast update: " << stats.monitorsWritten << " monitor(s) in "
+            << String(stats.durationMs, 1) << " ms, skew " << String(stats.skewMs, 1) << " ms\n";
+        editor->setFont(font);
+        editor->insertTextAtCaret(text);
+    }
+
+    const auto queueStats = mc->queueStats();
+    const char * classNames[] = {"interactive", "scheduled", "background"};
+    for (size_t i = 0; i < queueStats.classes.size(); ++i)
+    {
+        const auto & c = queueStats.classes[i];
+        if (c.samples == 0) continue;
+
+        juce::String text;
+        text << "Queue wait, " << classNames[i] << ": "
+            << String(c.totalWaitMs / (double) c.samples, 1) << " ms average, "
+            << String(c.maxWaitMs, 1) << " ms max";
+        if (i == 0)
+        {
+            text << ", " << (int) queueStats.interactiveTargetMisses << " over "
+                << (int) MonitorControl::QueueStats::interactiveTargetMs << " ms";
+        }
+        text << "\n";
+        editor->setFont(font);
+        editor->insertTextAtCaret(text);
+    }
+
+    {
+        const auto usage = currentResourceUsage();
+        const auto activity = mc->activityStats();
+        juce::String text;
+        text << "\nResources: " << String(usage.workingSetBytes / 1048576.0, 1) << " MB working set, "
+            << String(usage.cpuSeconds, 1) << " s CPU, " << activity.workerThreads << " worker thread(s), "
+            << String((int64) (activity.workerWakeups + messageThreadWakeups)) << " wakeups\n";
+        editor->setFont(font);
+        editor->insertTextAtCaret(text);
+    }
+
     editor->moveCaretToTop(false);
     editor->setReadOnly(true);
     editor->setColour(TextEditor::backgroundColourId, bgColor);
@@ -444,6 +672,12 @@ void showInfo()
     // get text bounds so we can size our window properly
     auto textBounds = editor->getTextBounds(Range<int>(0, editor->getTotalNumChars())).getBounds();
     textBounds.setWidth(std::max(300, textBounds.getWidth()));
+    if (textBounds.getHeight() > 600)
+    {
+        // lots of monitors, scroll instead
+        textBounds.setHeight(600);
+        editor->setScrollbarsShown(true);
+    }
     auto border = editor->getBorder();
     editor->setBounds(textBounds.expanded(border.getLeftAndRight() + 4, border.getTopAndBottom() + 4));
 
@@ -495,6 +729,7 @@ void editNeutralContrast()
             }
 
             MonitorControl::Settings mcSettings;
+            mcSettings.synchronizedUpdates = userSettings->getBoolValue("synchronizedUpdates", true);
             int i = 0;
             for (const auto & m : neutralContrastValues)
             {
@@ -511,22 +746,30 @@ void editNeutralContrast()
     juce::OptionalScopedPointer<OurComponent> content(new OurComponent, true);
     auto & neutralContrastValues = content->neutralContrastValues;
 
+    // The neutral contrast is stored per monitor name, so there is one row per
+    // name. A wall of identical panels stays manageable that way.
+    std::map<std::wstring, int> monitorsByName;
     for (const auto & m : list)
     {
+        if (!m.doesContrast) continue;
+        ++monitorsByName[m.name];
         neutralContrastValues[m.name] = {Value(m.neutralContrast), m.maxContrast};
     }
     juce::Colour bgColor = MonitorControlApplication::lookAndFeelInstance().findColour(DialogWindow::backgroundColourId);
 
     juce::Array<PropertyComponent*> properties;
-    for (auto pair : neutralContrastValues)
+    for (auto & pair : neutralContrastValues)
     {
         String jName = CharPointer_UTF16(pair.first.c_str());
+        const int count = monitorsByName[pair.first];
+        if (count > 1) { jName << " (" << count << " monitors)"; }
         properties.add(new SliderPropertyComponent(pair.second.first, jName, 0.0, pair.second.second, 1.0));
     }
-
-    int propertyHeight = 5 + 25 * (int) neutralContrastValues.size();
     content->propertyPanel.addProperties(properties);
 
+    // the property panel scrolls by itself beyond this height
+    int propertyHeight = std::min(400, 5 + content->propertyPanel.getTotalContentHeight());
+
     // layout (depends on amount of values)
     int y = 0;
     content->infoLabel.setBounds(0, y, 400, 25);
@@ -0,0 +1,96 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#include "resource_usage.h"
+
+#include <cstdint>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <cstdio>
+#include <cstring>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+
+#ifdef _WIN32
+
+static double seconds(const FILETIME & t)
+{
+    // 100 ns units
+    return (double) (((uint64_t) t.dwHighDateTime << 32) | t.dwLowDateTime) * 1e-7;
+}
+
+
+ResourceUsage currentResourceUsage()
+{
+    ResourceUsage usage;
+    PROCESS_MEMORY_COUNTERS memory = {};
+    memory.cb = sizeof(memory);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+    {
+        usage.workingSetBytes = memory.WorkingSetSize;
+        usage.peakWorkingSetBytes = memory.PeakWorkingSetSize;
+    }
+
+    FILETIME created, exited, kernel, user;
+    if (GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+    {
+        usage.cpuSeconds = seconds(kernel) + seconds(user);
+    }
+    return usage;
+}
+
+
+void trimWorkingSet()
+{
+    SetProcessWorkingSetSize(GetCurrentProcess(), (SIZE_T) -1, (SIZE_T) -1);
+}
+
+#else
+
+ResourceUsage currentResourceUsage()
+{
+    ResourceUsage usage;
+    if (FILE * status = std::fopen("/proc/self/status", "r"))
+    {
+        char line[256];
+        while (std::fgets(line, sizeof(line), status))
+        {
+            unsigned long kb = 0;
+            if (std::sscanf(line, "VmRSS: %lu kB", &kb) == 1) { usage.workingSetBytes = kb * 1024; }
+            if (std::sscanf(line, "VmHWM: %lu kB", &kb) == 1) { usage.peakWorkingSetBytes = kb * 1024; }
+        }
+        std::fclose(status);
+    }
+
+    rusage self = {};
+    if (getrusage(RUSAGE_SELF, &self) == 0)
+    {
+        usage.cpuSeconds =
+            (double) self.ru_utime.tv_sec + self.ru_utime.tv_usec * 1e-6 +
+            (double) self.ru_stime.tv_sec + self.ru_stime.tv_usec * 1e-6;
+    }
+    return usage;
+}
+
+
+void trimWorkingSet()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+#endif
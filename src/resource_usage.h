@@ -0,0 +1,28 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+
+// What the process costs while it sits in the tray.
+struct ResourceUsage
+{
+    size_t workingSetBytes = 0;
+    size_t peakWorkingSetBytes = 0;
+    // user + kernel time of all threads
+    double cpuSeconds = 0;
+};
+
+ResourceUsage currentResourceUsage();
+
+// Hand pages we aren't using back to the OS. They are faulted back in when
+// needed, so only call this when going idle.
+void trimWorkingSet();
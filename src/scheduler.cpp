@@ -0,0 +1,370 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+
+using Clock = std::chrono::steady_clock;
+using Ms = std::chrono::duration<double, std::milli>;
+
+
+struct BusScheduler::Batch
+{
+    std::vector<Command> commands;
+    std::vector<Clock::time_point> acknowledged;
+    Priority priority;
+    Clock::time_point submitted;
+    Completion done;
+    size_t remaining = 0;
+
+    // synchronized start: the lanes wait for each other before their first
+    // command of this batch
+    size_t lanesToArrive = 0;
+    bool open = true;
+    Clock::time_point released;
+    std::condition_variable gate;
+};
+
+
+struct BusScheduler::Lane
+{
+    std::array<std::deque<Entry>, 3> queues;
+    std::condition_variable wake;
+    std::thread thread;
+    bool stop = false;
+    // an entry was taken and isn't finished yet
+    bool busy = false;
+
+    bool hasWork() const
+    {
+        return std::any_of(queues.begin(), queues.end(), [](const auto & q) { return !q.empty(); });
+    }
+};
+
+
+BusScheduler::BusScheduler(int threads)
+    : maxThreads(std::max(1, threads))
+{}
+
+
+BusScheduler::~BusScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto & lane : lanes)
+        {
+            if (!lane) continue;
+            lane->stop = true;
+            lane->wake.notify_all();
+        }
+    }
+    for (auto & lane : lanes)
+    {
+        if (lane && lane->thread.joinable()) { lane->thread.join(); }
+    }
+}
+
+
+// with the mutex held
+BusScheduler::Lane & BusScheduler::laneFor(const Command & c)
+{
+    const size_t hash = std::hash<const void *>()(c.backend) ^ (std::hash<uint32_t>()(c.bus) * 31);
+    const size_t n = hash % (size_t) maxThreads;
+    if (lanes.size() <= n) { lanes.resize(n + 1); }
+
+    if (!lanes[n])
+    {
+        lanes[n] = std::make_unique<Lane>();
+        Lane & lane = *lanes[n];
+        lane.thread = std::thread([this, &lane]() { workerLoop(lane); });
+    }
+    return *lanes[n];
+}
+
+
+std::shared_ptr<BusScheduler::Batch> BusScheduler::enqueue(
+    std::vector<Command> && commands, Priority priority, bool synchronized, Completion done,
+    bool callerArrives)
+{
+    auto batch = std::make_shared<Batch>();
+    batch->commands = std::move(commands);
+    batch->acknowledged.resize(batch->commands.size());
+    batch->priority = priority;
+    batch->done = std::move(done);
+    batch->remaining = batch->commands.size();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    batch->submitted = Clock::now();
+    batch->released = batch->submitted;
+
+    std::vector<Lane *> laneOf(batch->commands.size());
+    std::vector<Lane *> used;
+    for (size_t i = 0; i < batch->commands.size(); ++i)
+    {
+        laneOf[i] = &laneFor(batch->commands[i]);
+        if (std::find(used.begin(), used.end(), laneOf[i]) == used.end()) { used.push_back(laneOf[i]); }
+    }
+
+    // Lanes that are in the middle of a command stay out of the gate and start
+    // as soon as that is done, so nobody waits for a slow command on another
+    // bus. A single lane has nobody to wait for, unless the caller has fast
+    // commands to start along with it.
+    const size_t idleLanes = (size_t) std::count_if(used.begin(), used.end(), [](const Lane * l) { return !l->busy; });
+    const size_t arrivals = idleLanes + (callerArrives ? 1 : 0);
+    const bool gated = synchronized && arrivals > 1;
+    if (gated)
+    {
+        batch->lanesToArrive = arrivals;
+        batch->open = false;
+    }
+
+    std::vector<Lane *> started;
+    for (size_t i = 0; i < batch->commands.size(); ++i)
+    {
+        bool first = false;
+        if (std::find(started.begin(), started.end(), laneOf[i]) == started.end())
+        {
+            started.push_back(laneOf[i]);
+            first = true;
+        }
+        const bool arrive = gated && first && !laneOf[i]->busy;
+        laneOf[i]->queues[(size_t) priority].push_back({batch, i, first, arrive});
+    }
+
+    for (auto * lane : used) { lane->wake.notify_one(); }
+    return batch;
+}
+
+
+static void perform(BusScheduler::Command & c)
+{
+    switch (c.kind)
+    {
+        case BusScheduler::Command::read:
+            c.ok = c.backend->getVcp(c.monitor, c.code, c.value, c.max);
+            break;
+        case BusScheduler::Command::write:
+            c.ok = c.backend->setVcp(c.monitor, c.code, c.value);
+            break;
+        case BusScheduler::Command::capabilities:
+            c.ok = c.backend->capabilities(c.monitor, c.caps);
+            break;
+    }
+}
+
+
+void BusScheduler::execute(const Entry & entry)
+{
+    perform(entry.batch->commands[entry.index]);
+    entry.batch->acknowledged[entry.index] = Clock::now();
+}
+
+
+// with the mutex held through `lock`
+void BusScheduler::finish(Batch & batch, size_t count)
+{
+    batch.remaining -= count;
+    if (batch.remaining == 0 && batch.done)
+    {
+        auto done = std::move(batch.done);
+        batch.done = nullptr;
+        done(batch.commands);
+    }
+}
+
+
+// with the mutex held through `lock`, returns once everyone has arrived
+void BusScheduler::arrive(Batch & batch, std::unique_lock<std::mutex> & lock)
+{
+    if (--batch.lanesToArrive == 0)
+    {
+        batch.open = true;
+        batch.released = Clock::now();
+        batch.gate.notify_all();
+    }
+    else
+    {
+        batch.gate.wait(lock, [&]() { return batch.open; });
+    }
+}
+
+
+void BusScheduler::workerLoop(Lane & lane)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        lane.wake.wait(lock, [&]() { return lane.stop || lane.hasWork(); });
+        if (lane.stop) return;
+        ++workerWakeups;
+        lane.busy = true;
+
+        auto & queue = *std::find_if(lane.queues.begin(), lane.queues.end(), [](const auto & q) { return !q.empty(); });
+        const Entry entry = queue.front();
+        queue.pop_front();
+        Batch & batch = *entry.batch;
+
+        if (entry.arrive) { arrive(batch, lock); }
+
+        if (entry.first)
+        {
+            const double waitMs = Ms(Clock::now() - batch.submitted).count();
+            auto & perClass = stats.classes[(size_t) batch.priority];
+            ++perClass.samples;
+            perClass.totalWaitMs += waitMs;
+            perClass.maxWaitMs = std::max(perClass.maxWaitMs, waitMs);
+            if (batch.priority == Priority::interactive && waitMs > MonitorControl::QueueStats::interactiveTargetMs)
+            {
+                ++stats.interactiveTargetMisses;
+            }
+        }
+
+        lock.unlock();
+        execute(entry);
+        lock.lock();
+
+        // the completion runs with the lock held, it should only hand results over
+        finish(batch, 1);
+        lane.busy = false;
+    }
+}
+
+
+MonitorControl::UpdateStats BusScheduler::run(std::vector<Command> & commands, bool synchronized, Priority priority)
+{
+    MonitorControl::UpdateStats result;
+    if (commands.empty()) return result;
+
+    // fast backends don't need a worker
+    std::vector<Command> slow;
+    std::vector<size_t> slowIndex, fastIndex;
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        if (commands[i].backend->isFast()) { fastIndex.push_back(i); }
+        else { slow.push_back(commands[i]); slowIndex.push_back(i); }
+    }
+
+    std::condition_variable finished;
+    bool isFinished = slow.empty();
+    std::shared_ptr<Batch> batch;
+    if (!slow.empty())
+    {
+        batch = enqueue(std::move(slow), priority, synchronized, [&](std::vector<Command> &)
+        {
+            isFinished = true;
+            finished.notify_all();
+        }, !fastIndex.empty());
+    }
+
+    // in a synchronized update the fast commands wait at the gate like a lane
+    if (batch && synchronized && !fastIndex.empty())
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!batch->open) { arrive(*batch, lock); }
+    }
+
+    Clock::time_point released = Clock::now();
+    std::vector<Clock::time_point> acknowledged(commands.size());
+    for (size_t i : fastIndex)
+    {
+        perform(commands[i]);
+        acknowledged[i] = Clock::now();
+    }
+
+    if (batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return isFinished; });
+        for (size_t k = 0; k < slowIndex.size(); ++k)
+        {
+            commands[slowIndex[k]] = batch->commands[k];
+            acknowledged[slowIndex[k]] = batch->acknowledged[k];
+        }
+        released = std::min(released, batch->released);
+    }
+
+    const auto range = std::minmax_element(acknowledged.begin(), acknowledged.end());
+    result.monitorsWritten = (int) commands.size();
+    result.durationMs = Ms(*range.second - released).count();
+    result.skewMs = Ms(*range.second - *range.first).count();
+    return result;
+}
+
+
+void BusScheduler::submit(std::vector<Command> commands, Priority priority, Completion done)
+{
+    if (commands.empty())
+    {
+        done(commands);
+        return;
+    }
+    enqueue(std::move(commands), priority, false, std::move(done));
+}
+
+
+void BusScheduler::cancel(Priority priority)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto & lane : lanes)
+    {
+        if (!lane) continue;
+
+        auto & queue = lane->queues[(size_t) priority];
+        for (const auto & e : queue)
+        {
+            e.batch->commands[e.index].cancelled = true;
+            finish(*e.batch, 1);
+        }
+        queue.clear();
+    }
+}
+
+
+MonitorControl::QueueStats BusScheduler::queueStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+
+MonitorControl::ActivityStats BusScheduler::activityStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    MonitorControl::ActivityStats activity;
+    activity.workerThreads = (int) std::count_if(lanes.begin(), lanes.end(), [](const auto & lane) { return lane != nullptr; });
+    activity.workerWakeups = workerWakeups;
+    return activity;
+}
+
+
+void BusScheduler::releaseIdleLanes()
+{
+    std::vector<std::unique_ptr<Lane>> idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto & lane : lanes)
+        {
+            if (!lane || lane->busy || lane->hasWork()) continue;
+            lane->stop = true;
+            lane->wake.notify_all();
+            idle.push_back(std::move(lane));
+        }
+
+        // drop the slots at the end, laneFor() grows them again
+        while (!lanes.empty() && !lanes.back()) { lanes.pop_back(); }
+        lanes.shrink_to_fit();
+    }
+
+    for (auto & lane : idle) { lane->thread.join(); }
+}
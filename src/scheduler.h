@@ -0,0 +1,145 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include "backend.h"
+#include "brightness.h"
+#include "vcp.h"
+
+#include <array>
+#include <cassert>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Runs VCP commands on the monitor buses. Commands on one bus are serialised,
+// different buses run in parallel on up to `maxThreads` worker threads, and
+// commands for fast backends are done inline on the calling thread.
+//
+// Every bus has a queue per priority class. A worker always picks the most
+// urgent command next, so interactive writes only ever wait for the one
+// command that is already on the bus. Queued background commands can be
+// cancelled.
+class BusScheduler
+{
+public:
+    using Priority = MonitorControl::Priority;
+
+    struct Command
+    {
+        enum Kind : uint8_t { read, write, capabilities };
+
+        MonitorBackend * backend;
+        MonitorBackend::Handle monitor;
+        uint32_t bus;
+        Kind kind;
+        uint8_t code;
+        // the value to write, or the value read
+        uint32_t value = 0;
+
+        // filled in when the command has run
+        uint32_t max = 0;
+        bool ok = false;
+        bool cancelled = false;
+        // the reply of a capabilities command
+        std::string caps = {};
+    };
+
+    // a write of VCP feature `Code`, checked at compile time
+    template <uint8_t Code>
+    static Command write(MonitorBackend * backend, MonitorBackend::Handle monitor, uint32_t bus,
+        typename VcpValue<Code>::type value)
+    {
+        checkVcpWritable<Code>();
+        return {backend, monitor, bus, Command::write, Code, (uint32_t) value};
+    }
+
+    // a read of VCP feature `Code`, checked at compile time
+    template <uint8_t Code>
+    static Command read(MonitorBackend * backend, MonitorBackend::Handle monitor, uint32_t bus)
+    {
+        checkVcpReadable<Code>();
+        return {backend, monitor, bus, Command::read, Code};
+    }
+
+    // the value of a finished read of VCP feature `Code`
+    template <uint8_t Code>
+    static typename VcpValue<Code>::type valueOf(const Command & c)
+    {
+        checkVcpReadable<Code>();
+        assert(c.kind == Command::read && c.code == Code);
+        return (typename VcpValue<Code>::type) c.value;
+    }
+
+    // a capabilities request, which takes a lot longer than the others
+    static Command capabilitiesOf(MonitorBackend * backend, MonitorBackend::Handle monitor, uint32_t bus)
+    {
+        return {backend, monitor, bus, Command::capabilities, 0};
+    }
+
+    using Completion = std::function<void(std::vector<Command> &)>;
+
+    explicit BusScheduler(int maxThreads = 64);
+    ~BusScheduler();
+
+    // Blocks until all commands are done. If `synchronized` is set the first
+    // command on every idle bus is held back until all of them are at the
+    // front of their queue, so they all start at the same moment. Buses that
+    // are busy with a command start when it is done, without holding up the
+    // others.
+    MonitorControl::UpdateStats run(std::vector<Command> & commands, bool synchronized,
+        Priority priority = Priority::interactive);
+
+    // Queues the commands and returns. `done` is called on a worker thread
+    // once all of them have run or were cancelled.
+    void submit(std::vector<Command> commands, Priority priority, Completion done);
+
+    // Drops the queued, not yet started commands of one priority class.
+    void cancel(Priority priority);
+
+    MonitorControl::QueueStats queueStats() const;
+    MonitorControl::ActivityStats activityStats() const;
+
+    // Stops the workers of lanes that have nothing queued or running. An idle
+    // worker doesn't wake up by itself, this only gives back its thread.
+    void releaseIdleLanes();
+
+private:
+    struct Batch;
+    struct Lane;
+
+    struct Entry
+    {
+        std::shared_ptr<Batch> batch;
+        size_t index;
+        // first command of its batch in this lane
+        bool first;
+        // and the batch is synchronized
+        bool arrive;
+    };
+
+    const int maxThreads;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Lane>> lanes;
+    MonitorControl::QueueStats stats;
+    uint64_t workerWakeups = 0;
+
+    std::shared_ptr<Batch> enqueue(std::vector<Command> && commands, Priority priority,
+        bool synchronized, Completion done, bool callerArrives = false);
+    Lane & laneFor(const Command & c);
+    void arrive(Batch & batch, std::unique_lock<std::mutex> & lock);
+    void workerLoop(Lane & lane);
+    void execute(const Entry & entry);
+    void finish(Batch & batch, size_t count);
+};
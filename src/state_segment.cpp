@@ -0,0 +1,123 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#include "state_segment.h"
+
+#include <climits>
+#include <new>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+struct SharedStatePublisher::Mapping
+{
+    HANDLE file = NULL;
+    void * view = nullptr;
+    // the segment name with "Changed" appended, see SHARED_STATE_EVENT_NAME
+    HANDLE changed = NULL;
+
+    explicit Mapping(const std::wstring & name)
+    {
+        file = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+            0, (DWORD) sizeof(SharedStateSegment), name.c_str());
+        if (file) { view = MapViewOfFile(file, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedStateSegment)); }
+        if (view) { changed = CreateEventW(NULL, TRUE, FALSE, (name + L"Changed").c_str()); }
+    }
+
+    ~Mapping()
+    {
+        if (changed) { CloseHandle(changed); }
+        if (view) { UnmapViewOfFile(view); }
+        if (file) { CloseHandle(file); }
+    }
+};
+
+#else
+
+struct SharedStatePublisher::Mapping
+{
+    std::string name;
+    void * view = nullptr;
+
+    explicit Mapping(const std::wstring & wideName)
+        : name(wideName.begin(), wideName.end())
+    {
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0) return;
+        if (ftruncate(fd, sizeof(SharedStateSegment)) == 0)
+        {
+            view = mmap(nullptr, sizeof(SharedStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (view == MAP_FAILED) { view = nullptr; }
+        }
+        close(fd);
+    }
+
+    ~Mapping()
+    {
+        if (view)
+        {
+            munmap(view, sizeof(SharedStateSegment));
+            shm_unlink(name.c_str());
+        }
+    }
+};
+
+#endif
+
+
+SharedStatePublisher::SharedStatePublisher(const std::wstring & segmentName)
+    : mapping(std::make_unique<Mapping>(segmentName))
+{
+    if (!mapping->view) return;
+
+    // Fresh mappings are zero filled. A leftover one may have been abandoned
+    // halfway through a write, with an odd sequence number.
+    segment = new (mapping->view) SharedStateSegment;
+    if (segment->sequence.load() & 1) { segment->sequence.fetch_add(1); }
+    segment->monitorCount = 0;
+    segment->totalMonitorCount = 0;
+    segment->version = sharedStateVersion;
+    segment->magic = sharedStateMagic;
+}
+
+
+// releases everyone who is waiting right now
+void SharedStatePublisher::wakeReaders()
+{
+#ifdef _WIN32
+    if (mapping->changed)
+    {
+        SetEvent(mapping->changed);
+        ResetEvent(mapping->changed);
+    }
+#elif defined(__linux__)
+    syscall(SYS_futex, &segment->generation, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+
+SharedStatePublisher::~SharedStatePublisher()
+{
+    if (segment)
+    {
+        publish([](SharedStateSegment & s)
+        {
+            s.monitorCount = 0;
+            s.totalMonitorCount = 0;
+        });
+    }
+}
@@ -0,0 +1,177 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+// Current per-monitor state, published in a small named shared memory
+// segment so other processes (status bars, scripts) can read it without
+// talking to us. This header is all a reader needs: map the segment
+// read-only and call readSharedState().
+//
+// The segment is guarded by a seqlock. The writer makes `sequence` odd while
+// it updates the contents and even again when done; a reader copies the data
+// and retries if `sequence` was odd or changed in the meantime. `generation`
+// goes up with every published change, so polling readers can compare that
+// first and skip the copy.
+//
+// Readers don't have to poll. On Windows the named event
+// SHARED_STATE_EVENT_NAME is pulsed after every change; a change can fall
+// between reading `generation` and starting to wait, so wait with a timeout.
+// On Linux waitForSharedState() blocks on `generation` itself, without that
+// gap.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// CreateFileMapping / OpenFileMapping name
+#define SHARED_STATE_SEGMENT_NAME L"Local\\MonitorBrightnessState"
+// OpenEvent name of the manual-reset event that is pulsed on changes
+#define SHARED_STATE_EVENT_NAME SHARED_STATE_SEGMENT_NAME L"Changed"
+#else
+// shm_open name
+#define SHARED_STATE_SEGMENT_NAME L"/monitor-brightness-state"
+#endif
+
+constexpr uint32_t sharedStateMagic = 0x5342434d; // "MCBS"
+constexpr uint32_t sharedStateVersion = 2;
+constexpr uint32_t maxSharedMonitors = 256;
+
+struct SharedMonitorState
+{
+    enum Flags : uint32_t
+    {
+        doesBrightness = 1,
+        doesContrast = 2,
+        responding = 4,
+        poweredOff = 8
+    };
+
+    char name[64];      // UTF-8, zero terminated, may be truncated
+    char source[16];
+    int32_t currentBrightness;
+    int32_t maxBrightness;
+    int32_t currentContrast;
+    int32_t maxContrast;
+    uint32_t flags;
+};
+
+struct SharedStateSegment
+{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> generation;
+    // the first monitorCount entries of `monitors` are valid
+    uint32_t monitorCount;
+    // all monitors we control; more than monitorCount if they didn't all fit
+    uint32_t totalMonitorCount;
+    SharedMonitorState monitors[maxSharedMonitors];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+    "the seqlock needs address-free atomics to work across processes");
+
+
+// Copy a consistent snapshot out of a mapped segment. Returns false if the
+// segment isn't ours, or if the writer kept it busy for all attempts.
+// `totalMonitors` is larger than monitors.size() if some were left out.
+inline bool readSharedState(
+    const SharedStateSegment & segment,
+    uint32_t & generation,
+    std::vector<SharedMonitorState> & monitors,
+    uint32_t & totalMonitors,
+    int attempts = 100)
+{
+    if (segment.magic != sharedStateMagic || segment.version != sharedStateVersion) return false;
+
+    for (int i = 0; i < attempts; ++i)
+    {
+        const uint32_t before = segment.sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        generation = segment.generation.load(std::memory_order_relaxed);
+        const uint32_t count = std::min(segment.monitorCount, maxSharedMonitors);
+        totalMonitors = std::max(segment.totalMonitorCount, count);
+        monitors.resize(count);
+        std::memcpy(monitors.data(), segment.monitors, count * sizeof(SharedMonitorState));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment.sequence.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+
+#ifdef __linux__
+// Blocks until `generation` is no longer the given one. Returns false if
+// that didn't happen within `timeoutMs`.
+inline bool waitForSharedState(const SharedStateSegment & segment, uint32_t generation, int timeoutMs)
+{
+    const timespec timeout{timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+    while (segment.generation.load(std::memory_order_acquire) == generation)
+    {
+        // not FUTEX_PRIVATE_FLAG, the writer is another process
+        if (syscall(SYS_futex, &segment.generation, FUTEX_WAIT, generation, &timeout, nullptr, 0) != 0 &&
+            errno == ETIMEDOUT)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+
+// Owns the segment on the writing side.
+class SharedStatePublisher
+{
+public:
+    struct Mapping;
+
+    explicit SharedStatePublisher(const std::wstring & segmentName);
+    ~SharedStatePublisher();
+
+    bool isValid() const { return segment != nullptr; }
+
+    // `fill` gets the segment while it is locked for writing
+    template <typename Fill>
+    void publish(Fill && fill)
+    {
+        if (!segment) return;
+        const uint32_t s = segment->sequence.load(std::memory_order_relaxed);
+        segment->sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        fill(*segment);
+
+        segment->generation.store(segment->generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        segment->sequence.store(s + 2, std::memory_order_release);
+        wakeReaders();
+    }
+
+private:
+    void wakeReaders();
+
+    std::unique_ptr<Mapping> mapping;
+    SharedStateSegment * segment = nullptr;
+};
@@ -0,0 +1,492 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, the backend files do not depend on JUCE and are
+available under GPLv3 and the MIT license.
+*/
+
+// Record and replay of backend traffic.
+//
+// Trace file layout (all integers little-endian):
+//
+//   header:  "DDCT", u16 version
+//   record:  u8 op, u8 source, u8 ok, u16 monitor, u32 start (µs since the
+//            trace started), u32 duration (µs), followed by an op specific
+//            payload:
+//     source         string8 name, u8 fast
+//     enumerate      u16 count, count × (u16 bus, string16 description, string8 model)
+//     capabilities   string8 caps
+//     get            u8 code, u32 current, u32 max
+//     set            u8 code, u32 value
+//
+//   string8 / string16: u16 length, then that many 8 or 16 bit units.
+//
+// One trace holds all backends. Each is announced by a `source` record
+// before its first call, and the other records carry its number. Monitors
+// are stored by their position in the last enumerate() result of their
+// backend, so a trace does not depend on the handle values of the machine it
+// came from.
+
+#include "backend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+
+namespace
+{
+    constexpr char traceMagic[4] = {'D', 'D', 'C', 'T'};
+    constexpr uint16_t traceVersion = 4;
+
+    enum class TraceOp : uint8_t
+    {
+        enumerate = 1,
+        capabilities = 2,
+        get = 3,
+        set = 4,
+        source = 5
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    uint32_t microseconds(Clock::duration d)
+    {
+        return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    }
+
+    struct TraceRecord
+    {
+        TraceOp op = TraceOp::enumerate;
+        uint8_t source = 0;
+        bool ok = false;
+        uint16_t monitor = 0;
+        uint32_t startUs = 0;
+        uint32_t durationUs = 0;
+        uint8_t code = 0;
+        uint32_t value = 0;
+        uint32_t max = 0;
+        std::string caps;
+        std::vector<std::wstring> descriptions;
+        std::vector<uint16_t> buses;
+        std::vector<std::string> models;
+        // of a source record
+        std::string name;
+        bool fast = false;
+    };
+
+
+    class TraceWriter
+    {
+        std::ofstream out;
+
+        void u8(uint8_t v) { out.put((char) v); }
+        void u16(uint16_t v) { u8(v & 0xff); u8(v >> 8); }
+        void u32(uint32_t v) { u16(v & 0xffff); u16(v >> 16); }
+
+    public:
+        explicit TraceWriter(const std::wstring & path)
+            : out(std::filesystem::path(path), std::ios::binary | std::ios::trunc)
+        {
+            out.write(traceMagic, 4);
+            u16(traceVersion);
+        }
+
+        void write(const TraceRecord & r)
+        {
+            u8((uint8_t) r.op);
+            u8(r.source);
+            u8(r.ok ? 1 : 0);
+            u16(r.monitor);
+            u32(r.startUs);
+            u32(r.durationUs);
+            switch (r.op)
+            {
+                case TraceOp::source:
+                    u16((uint16_t) r.name.size());
+                    out.write(r.name.data(), (std::streamsize) r.name.size());
+                    u8(r.fast ? 1 : 0);
+                    break;
+                case TraceOp::enumerate:
+                    u16((uint16_t) r.descriptions.size());
+                    for (size_t i = 0; i < r.descriptions.size(); ++i)
+                    {
+                        const auto & d = r.descriptions[i];
+                        u16(r.buses[i]);
+                        u16((uint16_t) d.size());
+                        for (wchar_t c : d) { u16((uint16_t) c); }
+                        u16((uint16_t) r.models[i].size());
+                        out.write(r.models[i].data(), (std::streamsize) r.models[i].size());
+                    }
+                    break;
+                case TraceOp::capabilities:
+                    u16((uint16_t) r.caps.size());
+                    out.write(r.caps.data(), (std::streamsize) r.caps.size());
+                    break;
+                case TraceOp::get:
+                    u8(r.code);
+                    u32(r.value);
+                    u32(r.max);
+                    break;
+                case TraceOp::set:
+                    u8(r.code);
+                    u32(r.value);
+                    break;
+            }
+            out.flush();
+        }
+    };
+
+
+    class TraceReader
+    {
+        std::ifstream in;
+
+        uint8_t u8() { return (uint8_t) in.get(); }
+        uint16_t u16() { uint16_t lo = u8(); return (uint16_t) (lo | (u8() << 8)); }
+        uint32_t u32() { uint32_t lo = u16(); return lo | ((uint32_t) u16() << 16); }
+
+    public:
+        explicit TraceReader(const std::wstring & path)
+            : in(std::filesystem::path(path), std::ios::binary)
+        {}
+
+        bool readHeader()
+        {
+            char magic[4] = {};
+            in.read(magic, 4);
+            return in && std::equal(magic, magic + 4, traceMagic) && u16() == traceVersion;
+        }
+
+        bool read(TraceRecord & r)
+        {
+            const int op = in.get();
+            if (op == std::char_traits<char>::eof()) return false;
+            r = TraceRecord{};
+            r.op = (TraceOp) op;
+            r.source = u8();
+            r.ok = u8() != 0;
+            r.monitor = u16();
+            r.startUs = u32();
+            r.durationUs = u32();
+            switch (r.op)
+            {
+                case TraceOp::source:
+                    r.name.assign(u16(), '\0');
+                    in.read(&r.name[0], (std::streamsize) r.name.size());
+                    r.fast = u8() != 0;
+                    break;
+                case TraceOp::enumerate:
+                {
+                    const uint16_t count = u16();
+                    for (uint16_t i = 0; i < count && in; ++i)
+                    {
+                        r.buses.push_back(u16());
+                        std::wstring d(u16(), L'\0');
+                        for (auto & c : d) { c = (wchar_t) u16(); }
+                        r.descriptions.push_back(std::move(d));
+                        std::string model(u16(), '\0');
+                        in.read(&model[0], (std::streamsize) model.size());
+                        r.models.push_back(std::move(model));
+                    }
+                    break;
+                }
+                case TraceOp::capabilities:
+                    r.caps.assign(u16(), '\0');
+                    in.read(&r.caps[0], (std::streamsize) r.caps.size());
+                    break;
+                case TraceOp::get:
+                    r.code = u8();
+                    r.value = u32();
+                    r.max = u32();
+                    break;
+                case TraceOp::set:
+                    r.code = u8();
+                    r.value = u32();
+                    break;
+                default:
+                    return false;
+            }
+            return (bool) in;
+        }
+    };
+}
+
+
+// the file all recording backends of one trace write to
+struct TraceFile
+{
+    TraceWriter writer;
+    const Clock::time_point start = Clock::now();
+    std::mutex mutex;
+    uint8_t sources = 0;
+
+    explicit TraceFile(const std::wstring & path) : writer(path) {}
+};
+
+
+class RecordingBackend : public MonitorBackend
+{
+    std::unique_ptr<MonitorBackend> inner;
+    const std::shared_ptr<TraceFile> file;
+    uint8_t source;
+
+    // guarded by file->mutex
+    std::unordered_map<Handle, uint16_t> monitorIndex;
+
+    // run `call` on the inner backend and log it
+    template <typename Call>
+    bool record(TraceRecord & r, Handle monitor, Call && call)
+    {
+        const auto start = Clock::now();
+        r.ok = call();
+        const auto end = Clock::now();
+        r.source = source;
+        r.startUs = microseconds(start - file->start);
+        r.durationUs = microseconds(end - start);
+
+        std::lock_guard<std::mutex> lock(file->mutex);
+        auto it = monitorIndex.find(monitor);
+        r.monitor = it != monitorIndex.end() ? it->second : 0xffff;
+        file->writer.write(r);
+        return r.ok;
+    }
+
+public:
+    RecordingBackend(std::unique_ptr<MonitorBackend> innerBackend, std::shared_ptr<TraceFile> traceFile)
+        : inner(std::move(innerBackend)), file(std::move(traceFile))
+    {
+        TraceRecord r;
+        r.op = TraceOp::source;
+        r.ok = true;
+        r.name = inner->name();
+        r.fast = inner->isFast();
+
+        std::lock_guard<std::mutex> lock(file->mutex);
+        source = file->sources++;
+        r.source = source;
+        file->writer.write(r);
+    }
+
+    virtual const char * name() const override { return inner->name(); }
+
+    virtual bool isFast() const override { return inner->isFast(); }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override
+    {
+        const auto start = Clock::now();
+        auto result = inner->enumerate();
+        const auto end = Clock::now();
+
+        TraceRecord r;
+        r.op = TraceOp::enumerate;
+        r.source = source;
+        r.ok = true;
+        r.startUs = microseconds(start - file->start);
+        r.durationUs = microseconds(end - start);
+
+        std::lock_guard<std::mutex> lock(file->mutex);
+        monitorIndex.clear();
+        for (const auto & m : result)
+        {
+            monitorIndex[m.handle] = (uint16_t) r.descriptions.size();
+            r.descriptions.push_back(m.description);
+            r.buses.push_back((uint16_t) m.bus);
+            r.models.push_back(m.model);
+        }
+        file->writer.write(r);
+        return result;
+    }
+
+    virtual bool capabilities(Handle monitor, std::string & caps) override
+    {
+        TraceRecord r;
+        r.op = TraceOp::capabilities;
+        return record(r, monitor, [&]()
+        {
+            bool ok = inner->capabilities(monitor, caps);
+            r.caps = caps;
+            return ok;
+        });
+    }
+
+    virtual bool getVcp(Handle monitor, uint8_t code, uint32_t & current, uint32_t & max) override
+    {
+        TraceRecord r;
+        r.op = TraceOp::get;
+        r.code = code;
+        return record(r, monitor, [&]()
+        {
+            bool ok = inner->getVcp(monitor, code, current, max);
+            r.value = current;
+            r.max = max;
+            return ok;
+        });
+    }
+
+    virtual bool setVcp(Handle monitor, uint8_t code, uint32_t value) override
+    {
+        TraceRecord r;
+        r.op = TraceOp::set;
+        r.code = code;
+        r.value = value;
+        return record(r, monitor, [&]()
+        {
+            return inner->setVcp(monitor, code, value);
+        });
+    }
+};
+
+
+class ReplayBackend : public MonitorBackend
+{
+    // Responses are queued per monitor, operation and VCP code, and served in
+    // recorded order. Once a queue runs dry its last response is repeated, so
+    // a short capture can drive an arbitrarily long benchmark.
+    struct Queue
+    {
+        std::vector<TraceRecord> records;
+        size_t next = 0;
+    };
+
+    using Key = std::tuple<uint16_t, TraceOp, uint8_t>;
+
+    const std::string backendName;
+    const bool fast;
+    std::vector<TraceRecord> enumerations;
+    size_t nextEnumeration = 0;
+    std::map<Key, Queue> queues;
+    std::mutex mutex;
+    const float timeScale;
+
+    static uint16_t toIndex(Handle h) { return (uint16_t) (h - 1); }
+
+    const TraceRecord * take(Handle monitor, TraceOp op, uint8_t code)
+    {
+        const TraceRecord * r = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = queues.find({toIndex(monitor), op, code});
+            if (it == queues.end() || it->second.records.empty()) return nullptr;
+            auto & q = it->second;
+            r = &q.records[std::min(q.next, q.records.size() - 1)];
+            ++q.next;
+        }
+        if (timeScale > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(r->durationUs * timeScale));
+        }
+        return r;
+    }
+
+public:
+    ReplayBackend(const TraceRecord & source, float scale)
+        : backendName(source.name + " (replay)"), fast(source.fast), timeScale(scale)
+    {}
+
+    void add(TraceRecord && r)
+    {
+        if (r.op == TraceOp::enumerate)
+        {
+            enumerations.push_back(std::move(r));
+        }
+        else
+        {
+            const uint8_t code = r.op == TraceOp::capabilities ? 0 : r.code;
+            queues[{r.monitor, r.op, code}].records.push_back(std::move(r));
+        }
+    }
+
+    virtual const char * name() const override { return backendName.c_str(); }
+
+    virtual bool isFast() const override { return fast; }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override
+    {
+        std::vector<PhysicalMonitor> result;
+        if (enumerations.empty()) return result;
+
+        const auto & r = enumerations[std::min(nextEnumeration, enumerations.size() - 1)];
+        ++nextEnumeration;
+        for (size_t i = 0; i < r.descriptions.size(); ++i)
+        {
+            result.push_back({(Handle) (i + 1), r.descriptions[i], r.buses[i], r.models[i]});
+        }
+        return result;
+    }
+
+    virtual bool capabilities(Handle monitor, std::string & caps) override
+    {
+        const auto * r = take(monitor, TraceOp::capabilities, 0);
+        if (!r) return false;
+        caps = r->caps;
+        return r->ok;
+    }
+
+    virtual bool getVcp(Handle monitor, uint8_t code, uint32_t & current, uint32_t & max) override
+    {
+        const auto * r = take(monitor, TraceOp::get, code);
+        if (!r) return false;
+        current = r->value;
+        max = r->max;
+        return r->ok;
+    }
+
+    virtual bool setVcp(Handle monitor, uint8_t code, uint32_t) override
+    {
+        const auto * r = take(monitor, TraceOp::set, code);
+        return r ? r->ok : false;
+    }
+};
+
+
+std::vector<std::unique_ptr<MonitorBackend>> createRecordingBackends(
+    std::vector<std::unique_ptr<MonitorBackend>> inner,
+    const std::wstring & tracePath)
+{
+    auto file = std::make_shared<TraceFile>(tracePath);
+    std::vector<std::unique_ptr<MonitorBackend>> result;
+    for (auto & backend : inner)
+    {
+        result.push_back(std::make_unique<RecordingBackend>(std::move(backend), file));
+    }
+    return result;
+}
+
+
+std::vector<std::unique_ptr<MonitorBackend>> createReplayBackends(
+    const std::wstring & tracePath,
+    float timeScale)
+{
+    std::vector<std::unique_ptr<MonitorBackend>> result;
+    std::vector<ReplayBackend *> sources;
+
+    TraceReader reader(tracePath);
+    if (!reader.readHeader()) return result;
+
+    TraceRecord r;
+    while (reader.read(r))
+    {
+        if (r.op == TraceOp::source)
+        {
+            if (sources.size() <= r.source) { sources.resize(r.source + 1u); }
+            auto backend = std::make_unique<ReplayBackend>(r, timeScale);
+            sources[r.source] = backend.get();
+            result.push_back(std::move(backend));
+        }
+        else if (r.source < sources.size() && sources[r.source])
+        {
+            sources[r.source]->add(std::move(r));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,150 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+
+// The MCCS VCP features we know about, and the checks behind the typed
+// BusScheduler commands. Misuse, like writing a read-only feature or a plain
+// number to a non-continuous feature, doesn't compile, so it can never reach
+// the bus.
+
+enum class VcpType : uint8_t
+{
+    continuous,     // a value between 0 and the maximum the monitor reports
+    nonContinuous   // one of a set of enumerated values
+};
+
+enum class VcpAccess : uint8_t
+{
+    readOnly,
+    writeOnly,
+    readWrite
+};
+
+struct VcpFeature
+{
+    uint8_t code;
+    const char * name;
+    VcpType type;
+    VcpAccess access;
+    // Writes are likely stored in the monitor's EEPROM, which only takes so
+    // many write cycles.
+    bool eeprom;
+};
+
+namespace Vcp
+{
+    constexpr uint8_t restoreFactoryDefaults = 0x04;
+    constexpr uint8_t brightness = 0x10;
+    constexpr uint8_t contrast = 0x12;
+    constexpr uint8_t colorPreset = 0x14;
+    constexpr uint8_t gainRed = 0x16;
+    constexpr uint8_t gainGreen = 0x18;
+    constexpr uint8_t gainBlue = 0x1A;
+    constexpr uint8_t inputSource = 0x60;
+    constexpr uint8_t volume = 0x62;
+    constexpr uint8_t usageTime = 0xC0;
+    constexpr uint8_t firmwareLevel = 0xC9;
+    constexpr uint8_t powerMode = 0xD6;
+    constexpr uint8_t version = 0xDF;
+}
+
+constexpr VcpFeature vcpFeatures[] =
+{
+    {Vcp::restoreFactoryDefaults, "Restore factory defaults", VcpType::nonContinuous, VcpAccess::writeOnly, true},
+    {Vcp::brightness, "Brightness", VcpType::continuous, VcpAccess::readWrite, true},
+    {Vcp::contrast, "Contrast", VcpType::continuous, VcpAccess::readWrite, true},
+    {Vcp::colorPreset, "Color preset", VcpType::nonContinuous, VcpAccess::readWrite, true},
+    {Vcp::gainRed, "Red gain", VcpType::continuous, VcpAccess::readWrite, true},
+    {Vcp::gainGreen, "Green gain", VcpType::continuous, VcpAccess::readWrite, true},
+    {Vcp::gainBlue, "Blue gain", VcpType::continuous, VcpAccess::readWrite, true},
+    {Vcp::inputSource, "Input source", VcpType::nonContinuous, VcpAccess::readWrite, false},
+    {Vcp::volume, "Speaker volume", VcpType::continuous, VcpAccess::readWrite, true},
+    {Vcp::usageTime, "Display usage time", VcpType::continuous, VcpAccess::readOnly, false},
+    {Vcp::firmwareLevel, "Firmware level", VcpType::continuous, VcpAccess::readOnly, false},
+    {Vcp::powerMode, "Power mode", VcpType::nonContinuous, VcpAccess::readWrite, false},
+    {Vcp::version, "VCP version", VcpType::nonContinuous, VcpAccess::readOnly, false},
+};
+
+
+// nullptr for unknown codes
+constexpr const VcpFeature * findVcpFeature(uint8_t code)
+{
+    for (const auto & f : vcpFeatures)
+    {
+        if (f.code == code) return &f;
+    }
+    return nullptr;
+}
+
+
+// Power mode values for VCP 0xD6.
+enum class PowerMode : uint32_t
+{
+    on = 1,
+    standby = 2,
+    suspend = 3,
+    off = 4,        // DPMS off
+    powerOff = 5    // switched off with the power button
+};
+
+
+// The value type of a feature. Continuous features take a plain number,
+// non-continuous ones need an enum specialisation here before they can be
+// used through the typed BusScheduler commands.
+template <uint8_t Code>
+struct VcpValue
+{
+    using type = uint32_t;
+};
+
+template <>
+struct VcpValue<Vcp::powerMode>
+{
+    using type = PowerMode;
+};
+
+
+template <uint8_t Code>
+constexpr const VcpFeature & vcpFeature()
+{
+    static_assert(findVcpFeature(Code) != nullptr, "unknown VCP code, add it to vcpFeatures");
+    return *findVcpFeature(Code);
+}
+
+
+template <uint8_t Code>
+constexpr void checkVcpValueType()
+{
+    using T = typename VcpValue<Code>::type;
+    static_assert(vcpFeature<Code>().type == VcpType::continuous || std::is_enum<T>::value,
+        "non-continuous VCP feature needs an enumerated value type");
+    static_assert(vcpFeature<Code>().type == VcpType::nonContinuous || !std::is_enum<T>::value,
+        "continuous VCP feature takes a plain value");
+}
+
+
+template <uint8_t Code>
+constexpr void checkVcpReadable()
+{
+    checkVcpValueType<Code>();
+    static_assert(vcpFeature<Code>().access != VcpAccess::writeOnly, "VCP feature is write-only");
+}
+
+
+template <uint8_t Code>
+constexpr void checkVcpWritable()
+{
+    checkVcpValueType<Code>();
+    static_assert(vcpFeature<Code>().access != VcpAccess::readOnly, "VCP feature is read-only");
+}
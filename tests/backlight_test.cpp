@@ -0,0 +1,179 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+// The backlight backend and MonitorControl on a fake sysfs tree.
+
+#include "check.h"
+
+#include "backend.h"
+#include "brightness.h"
+#include "vcp.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+
+namespace fs = std::filesystem;
+
+
+static void writeFile(const fs::path & file, const std::string & content)
+{
+    std::ofstream out(file);
+    out << content << "\n";
+}
+
+
+static std::string readFile(const fs::path & file)
+{
+    std::ifstream in(file);
+    std::string content;
+    in >> content;
+    return content;
+}
+
+
+// /sys/class/backlight with one usable panel and one without max_brightness
+static fs::path makeSysfsTree()
+{
+    const auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    const fs::path root = fs::temp_directory_path() / ("backlight_test_" + std::to_string(stamp));
+    fs::create_directories(root / "intel_backlight");
+    writeFile(root / "intel_backlight" / "max_brightness", "1000");
+    writeFile(root / "intel_backlight" / "brightness", "250");
+    fs::create_directories(root / "acpi_video0");
+    writeFile(root / "acpi_video0" / "brightness", "3");
+    return root;
+}
+
+
+static void testBackend(const fs::path & root)
+{
+    auto backend = createBacklightBackend(root.wstring());
+    CHECK(backend->isFast());
+
+    const auto panels = backend->enumerate();
+    CHECK(panels.size() == 1);
+    if (panels.size() != 1) return;
+    CHECK(panels[0].description == L"intel_backlight");
+
+    const auto h = panels[0].handle;
+    uint32_t current = 0, max = 0;
+    CHECK(backend->getVcp(h, Vcp::brightness, current, max));
+    CHECK(current == 250 && max == 1000);
+    CHECK(!backend->getVcp(h, Vcp::contrast, current, max));
+    CHECK(!backend->getVcp(h + 1, Vcp::brightness, current, max));
+
+    std::string caps;
+    CHECK(backend->capabilities(h, caps));
+    CHECK(caps.find("vcp(10)") != std::string::npos);
+
+    CHECK(backend->setVcp(h, Vcp::brightness, 400));
+    CHECK(readFile(root / "intel_backlight" / "brightness") == "400");
+    CHECK(!backend->setVcp(h, Vcp::contrast, 50));
+}
+
+
+// Not on Windows, where MonitorControl would find the real monitors too.
+#ifndef _WIN32
+static void testMonitorControl(const fs::path & root)
+{
+    writeFile(root / "intel_backlight" / "brightness", "500");
+
+    MonitorControl::Settings settings;
+    settings.backlightPath = root.wstring();
+    std::unique_ptr<MonitorControl> control(MonitorControl::create(std::move(settings)));
+
+    const auto monitors = control->monitorList();
+    CHECK(monitors.size() == 1);
+    if (monitors.size() != 1) return;
+    const auto * panel = &monitors[0];
+    CHECK(panel->source == "Backlight");
+    CHECK(panel->name == L"intel_backlight");
+    CHECK(panel->doesBrightness && !panel->doesContrast);
+    CHECK(panel->currentBrightness == 500 && panel->maxBrightness == 1000);
+    CHECK(control->hasAnySupportedMonitors());
+
+    control->setBrightness(.8f);
+    CHECK(readFile(root / "intel_backlight" / "brightness") == "800");
+}
+
+
+// a panel whose value can't be read at probe gets no writes either
+static void testFailedRead(const fs::path & root)
+{
+    const fs::path panels = root / "unreadable";
+    fs::create_directories(panels / "intel_backlight");
+    writeFile(panels / "intel_backlight" / "max_brightness", "1000");
+    writeFile(panels / "intel_backlight" / "brightness", "-");
+
+    MonitorControl::Settings settings;
+    settings.backlightPath = panels.wstring();
+    std::unique_ptr<MonitorControl> control(MonitorControl::create(std::move(settings)));
+
+    const auto monitors = control->monitorList();
+    CHECK(monitors.size() == 1);
+    if (monitors.size() != 1) return;
+    CHECK(monitors[0].maxBrightness == 0);
+
+    control->setBrightness(.8f);
+    CHECK(readFile(panels / "intel_backlight" / "brightness") == "-");
+}
+
+
+// the panel is recorded, and a replay leaves it alone
+static void testRecordAndReplay(const fs::path & root)
+{
+    const fs::path trace = root / "panel.ddct";
+    writeFile(root / "intel_backlight" / "brightness", "500");
+    {
+        MonitorControl::Settings settings;
+        settings.backlightPath = root.wstring();
+        settings.recordTrace = trace.wstring();
+        std::unique_ptr<MonitorControl> control(MonitorControl::create(std::move(settings)));
+        control->setBrightness(.3f);
+        CHECK(readFile(root / "intel_backlight" / "brightness") == "300");
+    }
+
+    writeFile(root / "intel_backlight" / "brightness", "900");
+    MonitorControl::Settings settings;
+    settings.backlightPath = root.wstring();
+    settings.replayTrace = trace.wstring();
+    settings.replayTimeScale = 0;
+    std::unique_ptr<MonitorControl> control(MonitorControl::create(std::move(settings)));
+
+    const auto monitors = control->monitorList();
+    CHECK(monitors.size() == 1);
+    if (monitors.size() != 1) return;
+    CHECK(monitors[0].source == "Backlight (replay)");
+    CHECK(monitors[0].currentBrightness == 500 && monitors[0].maxBrightness == 1000);
+
+    control->setBrightness(.3f);
+    CHECK(control->monitorList()[0].responding);
+    CHECK(readFile(root / "intel_backlight" / "brightness") == "900");
+}
+#endif
+
+
+int main()
+{
+    const fs::path root = makeSysfsTree();
+    testBackend(root);
+#ifndef _WIN32
+    testMonitorControl(root);
+    testFailedRead(root);
+    testRecordAndReplay(root);
+#endif
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+    return checkFailures();
+}
@@ -0,0 +1,32 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+#pragma once
+
+#include <cstdio>
+
+
+// Minimal test support: CHECK() reports a failed condition and carries on,
+// main() returns checkFailures() so CTest sees the outcome.
+
+inline int & checkFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++checkFailures(); \
+        } \
+    } while (false)
@@ -0,0 +1,210 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+// Slider drags through InputController in virtual time.
+
+#include "check.h"
+
+#include "input_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+
+using Clock = InputController::Clock;
+using Ms = std::chrono::duration<double, std::milli>;
+
+
+struct Write
+{
+    double timeMs;
+    float value;
+};
+
+
+// Drags the slider along `position` (time in ms to value) and releases it at
+// the end, with `eventsPerTick` mouse events every 10 ms. The extra events
+// of a tick come at the same time, part of the way to the next position.
+static std::vector<Write> drag(std::function<float(double)> position, double durationMs, int eventsPerTick = 1,
+    InputController::Tuning tuning = {})
+{
+    Clock::time_point t{};
+    std::vector<Write> writes;
+    InputController input(
+        [&](float v) { writes.push_back({Ms(t.time_since_epoch()).count(), v}); },
+        [&]() { return t; },
+        tuning);
+    input.reset(position(0));
+
+    const auto step = std::chrono::milliseconds(10);
+    input.dragStarted();
+    for (double ms = 10; ms <= durationMs; ms += 10)
+    {
+        t += step;
+        const float v = position(ms);
+        input.moved(v);
+        const float next = position(std::min(ms + 10, durationMs));
+        for (int i = 1; i < eventsPerTick; ++i) { input.moved(v + (next - v) * i / eventsPerTick); }
+
+        if (input.nextUpdate() == InputController::Duration(0)) { input.update(); }
+    }
+    t += step;
+    input.released(position(durationMs));
+
+    // let the throttle run out
+    for (int i = 0; i < 100; ++i)
+    {
+        t += step;
+        if (input.nextUpdate() == InputController::Duration(0)) { input.update(); }
+    }
+    return writes;
+}
+
+
+// when the panel got within `tolerance` of `value` and stayed there, -1 if never
+static double settleTime(const std::vector<Write> & writes, float value, float tolerance = .005f)
+{
+    double time = -1;
+    for (const auto & w : writes)
+    {
+        if (std::abs(w.value - value) > tolerance) { time = -1; }
+        else if (time < 0) { time = w.timeMs; }
+    }
+    return time;
+}
+
+
+static void testSteadyDrag()
+{
+    const auto writes = drag([](double ms) { return (float) (ms / 1000); }, 1000);
+
+    // the first move goes out at once, then one every 250 ms, and the release
+    CHECK(!writes.empty());
+    if (writes.empty()) return;
+    CHECK(writes.front().timeMs == 10);
+    CHECK(writes.size() >= 4 && writes.size() <= 6);
+    for (size_t i = 1; i < writes.size(); ++i)
+    {
+        CHECK(writes[i].timeMs - writes[i - 1].timeMs >= 250 || i + 1 == writes.size());
+    }
+    CHECK(writes.back().value == 1.f);
+}
+
+
+static void testSlowingDrag()
+{
+    // eases out towards .7, and stops there
+    const auto position = [](double ms)
+    {
+        const double x = std::min(1.0, ms / 600);
+        return (float) (.7 * (1 - (1 - x) * (1 - x)));
+    };
+    const auto writes = drag(position, 800);
+    InputController::Tuning following;
+    following.maxLead = 0;
+    const auto followed = drag(position, 800, 1, following);
+
+    CHECK(!writes.empty());
+    if (writes.empty()) return;
+    for (const auto & w : writes)
+    {
+        CHECK(w.value >= 0 && w.value <= 1);
+        // leads at most by maxLead
+        CHECK(w.value <= position(w.timeMs) + .1f + 1e-6f);
+    }
+    CHECK(writes.back().value == position(800));
+
+    // the prediction reaches .7 a write earlier than following the pointer,
+    // with no more writes: the one after the pointer stopped is exact, so
+    // the release at 810 ms has nothing left to send
+    const double predictedSettle = settleTime(writes, .7f);
+    const double followedSettle = settleTime(followed, .7f);
+    CHECK(predictedSettle > 0 && followedSettle > 0);
+    CHECK(predictedSettle + 250 <= followedSettle);
+    CHECK(writes.size() == 4 && followed.size() == 4);
+    CHECK(writes.back().timeMs == 760);
+}
+
+
+static void testPointerHeldStill()
+{
+    // slows down, then stops sending moves halfway through
+    Clock::time_point t{};
+    std::vector<float> writes;
+    InputController input([&](float v) { writes.push_back(v); }, [&]() { return t; });
+    input.reset(0);
+    input.dragStarted();
+
+    const auto position = [](int ms) { return (float) (1 - (1 - ms / 400.) * (1 - ms / 400.)); };
+    int ms = 0;
+    while (ms < 100)
+    {
+        ms += 10;
+        t += std::chrono::milliseconds(10);
+        input.moved(position(ms));
+        if (input.nextUpdate() == InputController::Duration(0)) { input.update(); }
+    }
+    while (input.nextUpdate() > InputController::Duration(0)) { t += std::chrono::milliseconds(10); }
+    input.update();
+
+    // the prediction is gone, the write is where the pointer is
+    CHECK(!writes.empty() && writes.back() == position(100));
+    CHECK(input.nextUpdate() < InputController::Duration(0));
+}
+
+
+static void testEventsWithinOneTick()
+{
+    // extra events without time passing don't change what is sent
+    const auto position = [](double ms) { return (float) (.8 * std::sin(std::min(ms, 500.0) / 500 * 1.5707963)); };
+    const auto single = drag(position, 700, 1);
+    const auto tripled = drag(position, 700, 3);
+
+    CHECK(single.size() == tripled.size());
+    for (size_t i = 0; i < single.size() && i < tripled.size(); ++i)
+    {
+        CHECK(single[i].timeMs == tripled[i].timeMs);
+        CHECK(single[i].value == tripled[i].value);
+    }
+}
+
+
+static void testClickWithoutDrag()
+{
+    Clock::time_point t{};
+    std::vector<float> writes;
+    InputController input([&](float v) { writes.push_back(v); }, [&]() { return t; });
+    input.reset(.2f);
+
+    input.moved(.6f);
+    CHECK(writes.size() == 1 && writes.back() == .6f);
+    CHECK(input.nextUpdate() < InputController::Duration(0));
+
+    // a second change right after waits for the interval
+    t += std::chrono::milliseconds(50);
+    input.moved(.4f);
+    CHECK(writes.size() == 1);
+    CHECK(input.nextUpdate() == InputController::Duration(200));
+    t += std::chrono::milliseconds(200);
+    input.update();
+    CHECK(writes.size() == 2 && writes.back() == .4f);
+}
+
+
+int main()
+{
+    testSteadyDrag();
+    testSlowingDrag();
+    testPointerHeldStill();
+    testEventsWithinOneTick();
+    testClickWithoutDrag();
+    return checkFailures();
+}
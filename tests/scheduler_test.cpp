@@ -0,0 +1,116 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+// Interactive writes under background load on the BusScheduler.
+
+#include "check.h"
+
+#include "scheduler.h"
+
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+using Clock = std::chrono::steady_clock;
+using Ms = std::chrono::duration<double, std::milli>;
+using Priority = MonitorControl::Priority;
+
+
+// A DDC-like backend with a bus per monitor. Reads of monitor 1 are slow,
+// like a capabilities request; everything else takes a few milliseconds.
+class SlowBackend : public MonitorBackend
+{
+public:
+    std::atomic<int64_t> lastWriteNs[3] = {};
+
+    virtual const char * name() const override { return "slow"; }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override { return {}; }
+    virtual bool capabilities(Handle, std::string &) override { return false; }
+
+    virtual bool getVcp(Handle monitor, uint8_t, uint32_t & current, uint32_t & max) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(monitor == 1 ? 300 : 5));
+        current = 50;
+        max = 100;
+        return true;
+    }
+
+    virtual bool setVcp(Handle monitor, uint8_t, uint32_t) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        lastWriteNs[monitor] = Clock::now().time_since_epoch().count();
+        return true;
+    }
+};
+
+
+static double msSince(Clock::time_point start, int64_t ns)
+{
+    return Ms(Clock::time_point(Clock::duration(ns)) - start).count();
+}
+
+
+static std::vector<BusScheduler::Command> writeAll(SlowBackend & backend, uint32_t value)
+{
+    std::vector<BusScheduler::Command> writes;
+    for (uint32_t m = 0; m < 3; ++m)
+    {
+        writes.push_back(BusScheduler::write<Vcp::brightness>(&backend, m, m, value));
+    }
+    return writes;
+}
+
+
+int main()
+{
+    SlowBackend backend;
+    BusScheduler scheduler;
+
+    // keep bus 1 busy in the background
+    std::vector<BusScheduler::Command> load;
+    for (int i = 0; i < 6; ++i) { load.push_back(BusScheduler::read<Vcp::brightness>(&backend, 1, 1)); }
+    std::atomic<bool> loadDone{false};
+    scheduler.submit(load, Priority::background, [&](std::vector<BusScheduler::Command> &) { loadDone = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    for (int round = 0; round < 3; ++round)
+    {
+        // a synchronized slider write to all three buses
+        const auto start = Clock::now();
+        auto writes = writeAll(backend, 30 + round);
+        scheduler.run(writes, true, Priority::interactive);
+        CHECK(writes[0].ok && writes[1].ok && writes[2].ok);
+
+        // the idle buses don't wait for the read on bus 1, and still go together
+        const double bus0 = msSince(start, backend.lastWriteNs[0]);
+        const double bus2 = msSince(start, backend.lastWriteNs[2]);
+        CHECK(bus0 < 50 && bus2 < 50);
+        CHECK(std::abs(bus0 - bus2) < 20);
+        // bus 1 goes right after its current read, before the rest of the load
+        CHECK(msSince(start, backend.lastWriteNs[1]) < 350);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    CHECK(!loadDone);
+
+    // One sample per bus and batch. Only bus 1 waited long.
+    const auto stats = scheduler.queueStats();
+    const auto & interactive = stats.classes[(size_t) Priority::interactive];
+    CHECK(interactive.samples == 9);
+    CHECK(interactive.maxWaitMs < 350);
+    CHECK(stats.interactiveTargetMisses <= 3);
+    CHECK(interactive.totalWaitMs < 3 * 350 + 6 * 50);
+
+    while (!loadDone) { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }
+    return checkFailures();
+}
@@ -0,0 +1,150 @@
+/*
+©2024 Roeland Schoukens
+
+This file is part of Monitor Brightness Control.
+
+Like brightness.cpp / .h, this file does not depend on JUCE and is
+available under GPLv3 and the MIT license.
+*/
+
+// Recording a backend and replaying the trace gives back the same answers.
+
+#include "check.h"
+
+#include "backend.h"
+#include "vcp.h"
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace fs = std::filesystem;
+
+
+class FakeBackend : public MonitorBackend
+{
+public:
+    FakeBackend(const char * backendName, bool fastBackend, std::vector<PhysicalMonitor> found)
+        : backendName(backendName), fast(fastBackend), monitors(std::move(found))
+    {}
+
+    virtual const char * name() const override { return backendName; }
+    virtual bool isFast() const override { return fast; }
+
+    virtual std::vector<PhysicalMonitor> enumerate() override { return monitors; }
+
+    virtual bool capabilities(Handle monitor, std::string & caps) override
+    {
+        caps = "(prot(monitor)vcp(10 12 D6)mccs_ver(2." + std::to_string(monitor) + "))";
+        return true;
+    }
+
+    virtual bool getVcp(Handle monitor, uint8_t code, uint32_t & current, uint32_t & max) override
+    {
+        if (code == Vcp::powerMode) return false;
+        current = (uint32_t) (monitor * 10 + code);
+        max = 100;
+        return true;
+    }
+
+    virtual bool setVcp(Handle monitor, uint8_t, uint32_t value) override
+    {
+        return value <= 100 && monitor != 7;
+    }
+
+private:
+    const char * backendName;
+    bool fast;
+    std::vector<PhysicalMonitor> monitors;
+};
+
+
+struct Answers
+{
+    std::vector<MonitorBackend::PhysicalMonitor> monitors;
+    std::vector<std::string> caps;
+    std::vector<bool> capsOk;
+    std::vector<uint32_t> current, max;
+    std::vector<bool> getOk, setOk;
+};
+
+
+// the same calls on every monitor, in the same order
+static Answers exercise(MonitorBackend & backend)
+{
+    Answers a;
+    a.monitors = backend.enumerate();
+    for (const auto & m : a.monitors)
+    {
+        std::string caps;
+        a.capsOk.push_back(backend.capabilities(m.handle, caps));
+        a.caps.push_back(caps);
+
+        for (uint8_t code : {Vcp::brightness, Vcp::contrast, Vcp::powerMode})
+        {
+            uint32_t current = 0, max = 0;
+            a.getOk.push_back(backend.getVcp(m.handle, code, current, max));
+            a.current.push_back(current);
+            a.max.push_back(max);
+        }
+        a.setOk.push_back(backend.setVcp(m.handle, Vcp::brightness, 40));
+        a.setOk.push_back(backend.setVcp(m.handle, Vcp::brightness, 400));
+    }
+    return a;
+}
+
+
+static void compare(const Answers & recorded, const Answers & replayed)
+{
+    CHECK(recorded.monitors.size() == replayed.monitors.size());
+    for (size_t i = 0; i < recorded.monitors.size() && i < replayed.monitors.size(); ++i)
+    {
+        CHECK(recorded.monitors[i].description == replayed.monitors[i].description);
+        CHECK(recorded.monitors[i].bus == replayed.monitors[i].bus);
+        CHECK(recorded.monitors[i].model == replayed.monitors[i].model);
+    }
+    CHECK(recorded.caps == replayed.caps);
+    CHECK(recorded.capsOk == replayed.capsOk);
+    CHECK(recorded.getOk == replayed.getOk);
+    CHECK(recorded.current == replayed.current);
+    CHECK(recorded.max == replayed.max);
+    CHECK(recorded.setOk == replayed.setOk);
+}
+
+
+int main()
+{
+    const auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    const fs::path trace = fs::temp_directory_path() / ("trace_test_" + std::to_string(stamp) + ".ddct");
+
+    std::vector<Answers> recorded;
+    {
+        std::vector<std::unique_ptr<MonitorBackend>> live;
+        live.push_back(std::make_unique<FakeBackend>("DDC/CI", false, std::vector<MonitorBackend::PhysicalMonitor>{
+            {3, L"Wall panel", 0, "ABC1234"},
+            {7, L"Wall panel", 2, "ABC1234"},
+            {9, L"Monitor ÄÖÜ", 5, ""}}));
+        live.push_back(std::make_unique<FakeBackend>("Backlight", true, std::vector<MonitorBackend::PhysicalMonitor>{
+            {1, L"intel_backlight", 1}}));
+
+        auto recording = createRecordingBackends(std::move(live), trace.wstring());
+        CHECK(recording.size() == 2);
+        for (auto & backend : recording) { recorded.push_back(exercise(*backend)); }
+    }
+
+    auto replay = createReplayBackends(trace.wstring(), 0);
+    CHECK(replay.size() == 2);
+    if (replay.size() == 2)
+    {
+        CHECK(std::string(replay[0]->name()) == "DDC/CI (replay)" && !replay[0]->isFast());
+        CHECK(std::string(replay[1]->name()) == "Backlight (replay)" && replay[1]->isFast());
+        for (size_t i = 0; i < replay.size(); ++i) { compare(recorded[i], exercise(*replay[i])); }
+    }
+
+    std::error_code ec;
+    fs::remove(trace, ec);
+    return checkFailures();
+}